@@ -0,0 +1,309 @@
+// Single-pass pintool combining the Lab1 register dependency histogram, the
+// Lab2 branch predictor evaluation and the Lab3 cache models.
+//
+// Every instruction is instrumented once, with one analysis call carrying
+// everything the enabled analyses need, so a run costs one JIT pass and one
+// call per instruction instead of three separate runs under Pin. Each
+// analysis can be switched off with -dep 0, -bp 0 or -cache 0.
+#include <iostream>
+#include <fstream>
+#include <map>
+#include "pin.H"
+#include "../Common/roi.h"
+#include "../Lab1/insDependDist.h"
+#include "../Lab2/brchPredict.h"
+#include "../Lab3/cacheModel.h"
+
+using std::cout;
+using std::endl;
+using std::ios;
+using std::ofstream;
+using std::string;
+
+KNOB<BOOL> KnobDeps(KNOB_MODE_WRITEONCE, "pintool",
+    "dep", "1", "enable the register dependency distance analysis");
+
+KNOB<BOOL> KnobBranches(KNOB_MODE_WRITEONCE, "pintool",
+    "bp", "1", "enable the branch predictor evaluation");
+
+KNOB<BOOL> KnobCaches(KNOB_MODE_WRITEONCE, "pintool",
+    "cache", "1", "enable the cache models");
+
+// This knob sets the output file name of the dependency histogram
+KNOB<string> KnobDepFile(KNOB_MODE_WRITEONCE, "pintool",
+    "dep_o", "insDependDist.csv", "specify the dependency output file name");
+
+// This knob sets the maximum dependency distance kept exactly
+KNOB<INT32> KnobMaxSize(KNOB_MODE_WRITEONCE, "pintool",
+    "s", "100", "specify the maximum distance of dependency");
+
+// This knob adds a predictor configuration to the bank (see newPredictor)
+KNOB<string> KnobPredictors(KNOB_MODE_APPEND, "pintool",
+    "p", "", "add a predictor, e.g. -p bht:12 -p tage:5:10:4:2:12");
+
+// This knob sets the output file name of the branch statistics
+KNOB<string> KnobBpFile(KNOB_MODE_WRITEONCE, "pintool",
+    "bp_o", "brchPredict.txt", "specify the branch output file name");
+
+// This knob will set the cache param m_block_num
+KNOB<UINT32> KnobBlockNum(KNOB_MODE_WRITEONCE, "pintool",
+    "n", "512", "specify the number of blocks in bytes");
+
+// This knob will set the cache param m_blksz_log
+KNOB<UINT32> KnobBlockSizeLog(KNOB_MODE_WRITEONCE, "pintool",
+    "b", "6", "specify the log of the block size in bytes");
+
+// This knob will set the cache param m_sets_log
+KNOB<UINT32> KnobSetsLog(KNOB_MODE_WRITEONCE, "pintool",
+    "r", "7", "specify the log of the number of rows");
+
+// This knob will set the cache param m_asso
+KNOB<UINT32> KnobAssociativity(KNOB_MODE_WRITEONCE, "pintool",
+    "a", "4", "specify the m_asso");
+
+BOOL trackDeps;
+BOOL trackBranches;
+BOOL trackCaches;
+
+/* ===================================================================== */
+/* Analysis state                                                        */
+/* ===================================================================== */
+
+INT32 maxSize;
+
+// All predictors under evaluation; each thread predicts with a bank of its
+// own and Fini merges their stats into this one
+PredictorBank bank;
+
+// Per-thread state, kept in Pin's TLS
+struct ThreadState {
+    UINT64 insPointer;
+    UINT64 lastInsPointer[1024];
+    DistHist* hist;
+    PredictorBank bank;
+    CacheModels* caches; // NULL unless the caches are tracked
+};
+
+TLS_KEY tlsKey;
+PIN_LOCK threadsLock;
+std::vector<ThreadState*> threadStates;
+
+// Add the predictors given with -p (bht:12 if none) to b; false if one is invalid
+BOOL addPredictors(PredictorBank& b)
+{
+    for (UINT32 i = 0; i < KnobPredictors.NumberOfValues(); i++) {
+        if (!KnobPredictors.Value(i).empty() && !b.add(KnobPredictors.Value(i))) {
+            std::cerr << "Unknown or invalid predictor " << KnobPredictors.Value(i) << endl;
+            return false;
+        }
+    }
+
+    if (b.size() == 0)
+        b.add("bht:12");
+
+    return true;
+}
+
+CacheModels* newCaches()
+{
+    return new CacheModels(KnobBlockNum.Value(), KnobSetsLog.Value(), KnobBlockSizeLog.Value(), KnobAssociativity.Value());
+}
+
+VOID ThreadStart(THREADID tid, CONTEXT* ctxt, INT32 flags, VOID* v)
+{
+    ThreadState* ts = new ThreadState();
+    ts->insPointer = 0;
+    memset(ts->lastInsPointer, 0, sizeof(ts->lastInsPointer));
+    ts->hist = new DistHist(maxSize);
+    if (trackBranches)
+        addPredictors(ts->bank);
+
+    // Each thread runs caches of its own, like a private cache per core, so
+    // the accesses need no lock; Fini adds up their stats
+    ts->caches = NULL;
+    if (trackCaches)
+        ts->caches = newCaches();
+
+    PIN_SetThreadData(tlsKey, ts, tid);
+
+    // The state outlives the thread so that Fini can merge it
+    PIN_GetLock(&threadsLock, tid + 1);
+    threadStates.push_back(ts);
+    PIN_ReleaseLock(&threadsLock);
+}
+
+/* ===================================================================== */
+/* Shared instrumentation                                                */
+/* ===================================================================== */
+
+// What the analysis routine has to do for one instruction; built once per
+// static instruction and shared by every instance of it
+struct InsDesc {
+    RegSet* regs; // NULL unless the dependencies are tracked
+    BOOL isBranch;
+    BOOL isRead;
+    BOOL isWrite;
+};
+
+// Descriptors, de-duplicated so that re-instrumented code reuses them
+Arena descArena;
+std::map<ADDRINT, InsDesc*> insDescs;
+
+VOID analyzeIns(THREADID tid, VOID* v, ADDRINT pc, ADDRINT readAddr, ADDRINT writeAddr, BOOL taken)
+{
+    InsDesc* desc = (InsDesc*)v;
+    ThreadState* ts = (ThreadState*)PIN_GetThreadData(tlsKey, tid);
+
+    if (desc->regs)
+        addRegDependDistance(++ts->insPointer, ts->lastInsPointer, desc->regs, ts->hist);
+
+    if (desc->isBranch)
+        ts->bank.predictBranch(pc, taken);
+
+    if (desc->isRead)
+        ts->caches->readReq(readAddr);
+    if (desc->isWrite)
+        ts->caches->writeReq(writeAddr);
+}
+
+// Return the descriptor of ins, building it on first sight; NULL if there
+// is nothing to analyse
+InsDesc* getInsDesc(INS ins)
+{
+    std::map<ADDRINT, InsDesc*>::iterator found = insDescs.find(INS_Address(ins));
+    if (found != insDescs.end())
+        return found->second;
+
+    InsDesc desc;
+    desc.regs = trackDeps ? newRegSet(ins, descArena) : NULL;
+    desc.isBranch = trackBranches && INS_IsControlFlow(ins) && INS_HasFallThrough(ins);
+    desc.isRead = trackCaches && INS_IsMemoryRead(ins);
+    desc.isWrite = trackCaches && INS_IsMemoryWrite(ins);
+
+    InsDesc* d = NULL;
+    if (desc.regs || desc.isBranch || desc.isRead || desc.isWrite) {
+        d = (InsDesc*)descArena.alloc(sizeof(InsDesc));
+        *d = desc;
+    }
+
+    insDescs[INS_Address(ins)] = d;
+    return d;
+}
+
+// Pin calls this function every time a new instruction is encountered
+VOID Instruction(INS ins, VOID* v)
+{
+    if (!ROI_Active())
+        return;
+
+    InsDesc* d = getInsDesc(ins);
+
+    // Nothing to analyse here
+    if (!d)
+        return;
+
+    // The arguments that only some instructions can provide
+    IARGLIST args = IARGLIST_Alloc();
+
+    if (d->isRead)
+        IARGLIST_AddArguments(args, IARG_MEMORYREAD_EA, IARG_END);
+    else
+        IARGLIST_AddArguments(args, IARG_ADDRINT, (ADDRINT)0, IARG_END);
+
+    if (d->isWrite)
+        IARGLIST_AddArguments(args, IARG_MEMORYWRITE_EA, IARG_END);
+    else
+        IARGLIST_AddArguments(args, IARG_ADDRINT, (ADDRINT)0, IARG_END);
+
+    if (d->isBranch)
+        IARGLIST_AddArguments(args, IARG_BRANCH_TAKEN, IARG_END);
+    else
+        IARGLIST_AddArguments(args, IARG_BOOL, FALSE, IARG_END);
+
+    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)analyzeIns, IARG_THREAD_ID, IARG_PTR, (VOID*)d,
+        IARG_INST_PTR, IARG_IARGLIST, args, IARG_END);
+
+    IARGLIST_Free(args);
+}
+
+// This function is called when the application exits
+VOID Fini(INT32 code, VOID* v)
+{
+    if (trackDeps) {
+        DistHist insDependDistance(maxSize);
+        for (size_t t = 0; t < threadStates.size(); t++)
+            insDependDistance.merge(*threadStates[t]->hist);
+
+        ofstream OutFile(KnobDepFile.Value().c_str());
+        OutFile.setf(ios::showbase);
+        insDependDistance.write(OutFile, false);
+        OutFile.close();
+    }
+
+    if (trackBranches) {
+        for (size_t t = 0; t < threadStates.size(); t++)
+            bank.merge(threadStates[t]->bank);
+        bank.write(cout);
+
+        ofstream OutFile(KnobBpFile.Value().c_str());
+        OutFile.setf(ios::showbase);
+        bank.write(OutFile);
+        OutFile.close();
+    }
+
+    if (trackCaches) {
+        CacheModels* caches = newCaches();
+        for (size_t t = 0; t < threadStates.size(); t++)
+            caches->merge(*threadStates[t]->caches);
+        caches->dumpResults();
+        delete caches;
+    }
+}
+
+/* ===================================================================== */
+/* Print Help Message                                                    */
+/* ===================================================================== */
+
+INT32 Usage()
+{
+    std::cerr << "This tool runs the dependency, branch and cache analyses in one pass" << endl;
+    std::cerr << endl << KNOB_BASE::StringKnobSummary() << endl;
+    return -1;
+}
+
+/* ===================================================================== */
+/* Main                                                                  */
+/* ===================================================================== */
+
+int main(int argc, char* argv[])
+{
+    // Initialize pin
+    if (PIN_Init(argc, argv))
+        return Usage();
+    ROI_Init();
+
+    trackDeps = KnobDeps.Value();
+    trackBranches = KnobBranches.Value();
+    trackCaches = KnobCaches.Value();
+
+    maxSize = KnobMaxSize.Value();
+
+    tlsKey = PIN_CreateThreadDataKey(0);
+    PIN_InitLock(&threadsLock);
+
+    if (trackBranches && !addPredictors(bank))
+        return Usage();
+
+    PIN_AddThreadStartFunction(ThreadStart, 0);
+
+    // Register Instruction to be called to instrument instructions
+    INS_AddInstrumentFunction(Instruction, 0);
+
+    // Register Fini to be called when the application exits
+    PIN_AddFiniFunction(Fini, 0);
+
+    // Start the program, never returns
+    PIN_StartProgram();
+
+    return 0;
+}
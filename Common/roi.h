@@ -0,0 +1,267 @@
+// Region-of-interest (ROI) and sampling control shared by the pintools.
+//
+// A tool calls ROI_Init() right after PIN_Init() and returns early from its
+// instrumentation routines while ROI_Active() is false. Every ROI transition
+// removes all instrumentation, so code is re-instrumented with (or without)
+// the tool's analysis calls the next time it runs; outside the ROI only the
+// ROI's own, cheap counting and marker calls remain.
+//
+// The ROI is selected with one of
+//   -roi_rtn <name>            analyse while <name> is executing
+//   -roi_marker 1              start at "xchg %bx,%bx", stop at "xchg %cx,%cx"
+//   -roi_skip N -roi_run M     skip N instructions, then analyse M of them
+// and -roi_period P turns the last one into periodic sampling: after the
+// first N instructions, every P instructions analyse M and fast-forward
+// through the remaining P - M.
+//
+// Transitions flush the code cache. A routine or marker ROI that toggles
+// often can be rate-limited with -roi_min_gap G: such a transition requested
+// less than G instructions after the previous flush waits until the gap has
+// passed, and the transitions delayed this way are reported at exit. The
+// phase switches of -roi_skip/-roi_run/-roi_period are never delayed.
+//
+// The instruction count is shared by all threads. Each thread adds its
+// instructions to it atomically every ROI_BATCH instructions, so phase
+// boundaries are exact to within ROI_BATCH instructions per thread.
+#ifndef ROI_H
+#define ROI_H
+
+#include <iostream>
+#include <string>
+#include "pin.H"
+
+KNOB<std::string> KnobRoiRtn(KNOB_MODE_WRITEONCE, "pintool",
+    "roi_rtn", "", "analyse only while the named routine is executing");
+
+KNOB<BOOL> KnobRoiMarker(KNOB_MODE_WRITEONCE, "pintool",
+    "roi_marker", "0", "start the ROI at xchg %bx,%bx and stop it at xchg %cx,%cx");
+
+KNOB<UINT64> KnobRoiSkip(KNOB_MODE_WRITEONCE, "pintool",
+    "roi_skip", "0", "specify the number of instructions to skip before the ROI");
+
+KNOB<UINT64> KnobRoiRun(KNOB_MODE_WRITEONCE, "pintool",
+    "roi_run", "0", "specify the number of instructions to analyse (0: until exit)");
+
+KNOB<UINT64> KnobRoiPeriod(KNOB_MODE_WRITEONCE, "pintool",
+    "roi_period", "0", "repeat the run phase every N instructions (0: no sampling)");
+
+KNOB<UINT64> KnobRoiMinGap(KNOB_MODE_WRITEONCE, "pintool",
+    "roi_min_gap", "0", "specify the minimum number of instructions between two flushes caused by -roi_rtn or -roi_marker");
+
+#define ROI_BATCH       4096    // Instructions a thread counts before adding them to the total
+#define ROI_MAX_THREADS 1024    // Threads with a counter of their own; the others add at once
+
+static volatile BOOL roiActive = TRUE;  // State the code is instrumented for
+static volatile BOOL roiWanted = TRUE;  // State requested by the ROI selection
+static volatile UINT32 roiDepth = 0;    // Nesting depth of the ROI routine
+static PIN_LOCK roiLock;                // Serialises the transitions
+
+static volatile UINT64 roiInsCount = 0;         // Instruction count of all threads
+static UINT64 roiNextSwitch = ~0ULL;            // Instruction count of the next phase switch
+static UINT64 roiNextFlush = 0;                 // First instruction count a flush may happen at
+static volatile UINT64 roiNextCheck = ~0ULL;    // Next switch, or the pending transition
+
+static UINT64 roiHeldSince = ~0ULL;     // Instruction count the pending transition was delayed at
+static UINT64 roiHeld = 0;              // Transitions delayed by -roi_min_gap
+static UINT64 roiHeldIns = 0;           // Instructions they were delayed by in total
+static UINT64 roiDropped = 0;           // Delayed transitions withdrawn before the gap passed
+
+// Instructions a thread has not added to roiInsCount yet, one cache line each
+static struct {
+    UINT64 count;
+    UINT8 pad[56];
+} roiThreadCount[ROI_MAX_THREADS];
+
+// Whether the tools should instrument their analysis right now
+inline BOOL ROI_Active() { return roiActive; }
+
+// Apply roiWanted unless throttle is set and the previous flush is too
+// recent, then schedule the next check; roiLock is held. Returns whether to
+// flush.
+static BOOL ROI_Apply(BOOL throttle)
+{
+    BOOL flush = FALSE;
+    if (roiWanted != roiActive && (!throttle || roiInsCount >= roiNextFlush)) {
+        roiActive = roiWanted;
+        roiNextFlush = roiInsCount + KnobRoiMinGap.Value();
+        flush = TRUE;
+    }
+
+    if (roiWanted != roiActive) {
+        if (roiHeldSince == ~0ULL) {
+            roiHeldSince = roiInsCount;
+            roiHeld++;
+        }
+    } else if (roiHeldSince != ~0ULL) {
+        roiHeldIns += roiInsCount - roiHeldSince;
+        roiHeldSince = ~0ULL;
+        if (!flush)
+            roiDropped++;
+    }
+
+    roiNextCheck = roiWanted != roiActive && roiNextFlush < roiNextSwitch ? roiNextFlush : roiNextSwitch;
+    return flush;
+}
+
+static VOID ROI_Set(BOOL active, THREADID tid)
+{
+    PIN_GetLock(&roiLock, tid + 1);
+    roiWanted = active;
+    BOOL flush = ROI_Apply(TRUE);
+    PIN_ReleaseLock(&roiLock);
+
+    if (flush)
+        PIN_RemoveInstrumentation();
+}
+
+static VOID ROI_Start(THREADID tid) { ROI_Set(TRUE, tid); }
+static VOID ROI_Stop(THREADID tid) { ROI_Set(FALSE, tid); }
+
+static VOID ROI_EnterRtn(THREADID tid)
+{
+    if (__sync_fetch_and_add(&roiDepth, 1) == 0)
+        ROI_Start(tid);
+}
+
+static VOID ROI_LeaveRtn(THREADID tid)
+{
+    UINT32 depth;
+    do {
+        depth = roiDepth;
+        if (depth == 0)
+            return;
+    } while (!__sync_bool_compare_and_swap(&roiDepth, depth, depth - 1));
+
+    if (depth == 1)
+        ROI_Stop(tid);
+}
+
+// Count the instructions of a basic block; true when a phase switch or a
+// delayed transition is due
+static ADDRINT PIN_FAST_ANALYSIS_CALL ROI_Count(THREADID tid, UINT32 numIns)
+{
+    UINT64 total;
+    if (tid < ROI_MAX_THREADS) {
+        UINT64& count = roiThreadCount[tid].count;
+        count += numIns;
+        if (count < ROI_BATCH)
+            return FALSE;
+
+        total = __sync_add_and_fetch(&roiInsCount, count);
+        count = 0;
+    } else {
+        total = __sync_add_and_fetch(&roiInsCount, (UINT64)numIns);
+    }
+    return total >= roiNextCheck;
+}
+
+// Switch between the skip and the run phase, or apply a delayed transition
+static VOID ROI_Switch(THREADID tid)
+{
+    PIN_GetLock(&roiLock, tid + 1);
+
+    // Another thread may have switched already; a phase switch is never
+    // delayed, so the phases keep their lengths
+    BOOL switched = roiInsCount >= roiNextSwitch;
+    if (switched) {
+        UINT64 run = KnobRoiRun.Value();
+        UINT64 period = KnobRoiPeriod.Value();
+
+        if (!roiWanted) {
+            roiNextSwitch = run ? roiNextSwitch + run : ~0ULL;
+            roiWanted = TRUE;
+        } else {
+            roiNextSwitch = period ? roiNextSwitch + period - run : ~0ULL;
+            roiWanted = FALSE;
+        }
+    }
+
+    BOOL flush = ROI_Apply(!switched);
+    PIN_ReleaseLock(&roiLock);
+
+    if (flush)
+        PIN_RemoveInstrumentation();
+}
+
+// Report the transitions -roi_min_gap delayed, which moved the ROI boundaries
+static VOID ROI_Fini(INT32 code, VOID* v)
+{
+    if (roiHeldSince != ~0ULL)
+        roiHeldIns += roiInsCount - roiHeldSince;
+    if (roiHeld == 0)
+        return;
+
+    std::cerr << "ROI: " << roiHeld << " transition(s) delayed by -roi_min_gap " << KnobRoiMinGap.Value()
+              << ", " << roiHeldIns << " instructions in total";
+    if (roiDropped > 0)
+        std::cerr << ", " << roiDropped << " of them withdrawn before the gap passed";
+    if (roiHeldSince != ~0ULL)
+        std::cerr << ", 1 still pending at exit";
+    std::cerr << std::endl;
+}
+
+static VOID ROI_Trace(TRACE trace, VOID* v)
+{
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
+        BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)ROI_Count, IARG_FAST_ANALYSIS_CALL,
+            IARG_THREAD_ID, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+        BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)ROI_Switch, IARG_THREAD_ID, IARG_END);
+
+        if (!KnobRoiMarker.Value())
+            continue;
+
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins)) {
+            if (INS_Opcode(ins) != XED_ICLASS_XCHG || !INS_OperandIsReg(ins, 0) || !INS_OperandIsReg(ins, 1)
+                || INS_OperandReg(ins, 0) != INS_OperandReg(ins, 1))
+                continue;
+
+            if (INS_OperandReg(ins, 0) == REG_BX)
+                INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)ROI_Start, IARG_THREAD_ID, IARG_END);
+            else if (INS_OperandReg(ins, 0) == REG_CX)
+                INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)ROI_Stop, IARG_THREAD_ID, IARG_END);
+        }
+    }
+}
+
+static VOID ROI_Image(IMG img, VOID* v)
+{
+    RTN rtn = RTN_FindByName(img, KnobRoiRtn.Value().c_str());
+    if (!RTN_Valid(rtn))
+        return;
+
+    RTN_Open(rtn);
+    RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)ROI_EnterRtn, IARG_THREAD_ID, IARG_END);
+    RTN_InsertCall(rtn, IPOINT_AFTER, (AFUNPTR)ROI_LeaveRtn, IARG_THREAD_ID, IARG_END);
+    RTN_Close(rtn);
+}
+
+// Register the ROI instrumentation; call after PIN_Init()
+static VOID ROI_Init()
+{
+    if (!KnobRoiRtn.Value().empty()) {
+        PIN_InitSymbols();
+        IMG_AddInstrumentFunction(ROI_Image, 0);
+        roiActive = roiWanted = FALSE;
+    }
+
+    if (KnobRoiMarker.Value())
+        roiActive = roiWanted = FALSE;
+
+    if (KnobRoiSkip.Value() > 0) {
+        roiNextSwitch = KnobRoiSkip.Value();
+        roiActive = roiWanted = FALSE;
+    } else if (KnobRoiRun.Value() > 0) {
+        roiNextSwitch = KnobRoiRun.Value();
+    }
+    roiNextCheck = roiNextSwitch;
+
+    // Without a ROI the analysis runs throughout and nothing is counted
+    if (roiActive && roiNextSwitch == ~0ULL)
+        return;
+
+    PIN_InitLock(&roiLock);
+    TRACE_AddInstrumentFunction(ROI_Trace, 0);
+    PIN_AddFiniFunction(ROI_Fini, 0);
+}
+
+#endif // ROI_H
@@ -12,7 +12,13 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <map>
+#include <sstream>
+#include <algorithm>
+#include <functional>
 #include "pin.H"
+#include "../Common/roi.h"
+#include "insDependDist.h"
 using std::cerr;
 using std::ofstream;
 using std::ios;
@@ -22,91 +28,515 @@ using std::vector;
 
 ofstream OutFile;
 
-// Convenience data structure
-typedef uint32_t reg_t;
-struct Registers
+// Per-thread dependency tracking state, reached through Pin TLS
+struct ThreadState
 {
-	vector<reg_t> read;
-	vector<reg_t> write;
+	UINT64 insPointer;                  // Number of instructions executed by the thread
+	UINT64 lastInsPointer[1024];        // Index of the last instruction writing each register
+	UINT64 lastReadPointer[1024];       // Index of the last instruction reading each register
+	DistHist *insDependDistance;        // The thread's distance histogram
+	DistHist *memDependDistance;        // The thread's memory (store-to-load) distance histogram
+	DistHist *warDependDistance;        // The thread's write-after-read distance histogram
+	DistHist *wawDependDistance;        // The thread's write-after-write distance histogram
+	ShadowMemory *shadow;               // Last writer of every memory word (memory mode only)
+	IlpWindow *ilp;                     // One dataflow model per window size (ILP mode only)
+	UINT64 ilpInsCount;                 // Instructions fed to the dataflow models
+	THREADID tid;
+
+	ADDRINT lastWriterPc[1024];         // Address of the last instruction writing each register
+	PairTable *hotPairs;                // Dependencies within -s per (producer, consumer) pair
+
+	UINT64 nextSnapshot;                // insPointer at which the next interval snapshot is due
+	DistHist *lastInsSnapshot;          // Histograms at the previous snapshot
+	DistHist *lastMemSnapshot;
+	DistHist *lastWarSnapshot;
+	DistHist *lastWawSnapshot;
 };
 
 // Global variables
 // The array storing the distance frequency between two dependant instructions
-UINT64 *insDependDistance;
+// (merged from all threads in Fini)
+DistHist *insDependDistance;
+DistHist *memDependDistance;
+DistHist *warDependDistance;
+DistHist *wawDependDistance;
 INT32 maxSize;
-INT32 insPointer = 0;
-INT32 lastInsPointer[1024] = { 0 };
+BOOL writeTail;                         // Append the log2 tail buckets to every histogram line
+UINT64 snapshotInterval;                // Instructions between interval snapshots (0: none)
+ofstream SnapshotFile;
+PIN_LOCK snapshotLock;
+BOOL trackMemory;
+BOOL trackFalseDeps;                    // Also measure WAR and WAW distances
+BOOL estimateIlp;
+UINT32 hotSpots;                        // Number of (producer, consumer) pairs to report (0: off)
+
+// Disassembly, routine and image of every instruction (hot-spot report only)
+struct InsInfo
+{
+	string disasm;
+	string rtn;
+	string img;
+};
+std::map<ADDRINT, InsInfo> insInfos;
+vector<UINT32> ilpWindows;              // Window sizes of the ILP estimation
+std::map<string, UINT16> opLatency;     // Per-mnemonic latencies (1 cycle if absent)
+
+TLS_KEY tlsKey;
+PIN_LOCK threadsLock;
+vector<ThreadState*> threadStates;
+
+// Descriptors, de-duplicated so that re-instrumented code reuses them
+Arena descArena;
+std::map<ADDRINT, RegSet*> insDescs;
+std::map<std::pair<ADDRINT, UINT32>, BlockDeps*> blockDescs;
+
+// Append the histograms gathered by ts since its previous snapshot to the
+// interval stream as "tid,instructions,reg|mem,counts..." lines.
+// This runs once per interval, so the lock stays off the common path.
+VOID WriteSnapshot(ThreadState *ts)
+{
+	PIN_GetLock(&snapshotLock, ts->tid + 1);
+
+	SnapshotFile << ts->tid << "," << ts->insPointer << ",reg,";
+	ts->insDependDistance->write(SnapshotFile, writeTail, ts->lastInsSnapshot);
+	SnapshotFile << endl;
+
+	if (trackMemory)
+	{
+		SnapshotFile << ts->tid << "," << ts->insPointer << ",mem,";
+		ts->memDependDistance->write(SnapshotFile, writeTail, ts->lastMemSnapshot);
+		SnapshotFile << endl;
+	}
+
+	if (trackFalseDeps)
+	{
+		SnapshotFile << ts->tid << "," << ts->insPointer << ",war,";
+		ts->warDependDistance->write(SnapshotFile, writeTail, ts->lastWarSnapshot);
+		SnapshotFile << endl;
+
+		SnapshotFile << ts->tid << "," << ts->insPointer << ",waw,";
+		ts->wawDependDistance->write(SnapshotFile, writeTail, ts->lastWawSnapshot);
+		SnapshotFile << endl;
+	}
+
+	PIN_ReleaseLock(&snapshotLock);
+
+	ts->lastInsSnapshot->copy(*ts->insDependDistance);
+	if (trackMemory)
+		ts->lastMemSnapshot->copy(*ts->memDependDistance);
+	if (trackFalseDeps)
+	{
+		ts->lastWarSnapshot->copy(*ts->warDependDistance);
+		ts->lastWawSnapshot->copy(*ts->wawDependDistance);
+	}
+
+	ts->nextSnapshot = (ts->insPointer / snapshotInterval + 1) * snapshotInterval;
+}
+
+// Feed one instruction to the dataflow model of every window size
+inline VOID updateIlp(ThreadState *ts, RegSet *regs)
+{
+	UINT16 *src = regsOf(regs);
+	UINT16 *dst = src + regs->numRead;
+	UINT64 slot = ts->ilpInsCount++;
+
+	for (IlpWindow *w = ts->ilp; w != ts->ilp + ilpWindows.size(); w++)
+	{
+		UINT64 *retire = &w->retire[slot % w->size];
+
+		// The instruction `size` places older has to leave the window first
+		UINT64 ready = *retire;
+		for (UINT16 *reg = src; reg != dst; reg++)
+			if (w->regReady[*reg] > ready)
+				ready = w->regReady[*reg];
+
+		UINT64 complete = ready + regs->latency;
+		for (UINT16 *reg = dst; reg != dst + regs->numWrite; reg++)
+			w->regReady[*reg] = complete;
+
+		if (complete > w->lastRetire)
+			w->lastRetire = complete;
+		*retire = w->lastRetire;
+	}
+}
 
 // This function is called before every instruction is executed. 
 // You have to edit this function to determine the dependency distance
 // and populate the insDependDistance data structure.
-VOID (VOID *v)
+VOID updateInsDependDistance(THREADID tid, VOID *v)
 {
+	ThreadState *ts = (ThreadState*)PIN_GetThreadData(tlsKey, tid);
+
 	// Update the instruction pointer
-	++insPointer;
+	UINT64 insPointer = ++ts->insPointer;
 
-	// regs contains the registers read and written by this instruction.
-	// regs->read contains the registers read.
-	// regs->write contains the registers written.
-	Registers *regs = (Registers*)v;
+	// regs contains the registers read and written by this instruction:
+	// the first regs->numRead entries are read, the next regs->numWrite written.
+	RegSet *regs = (RegSet*)v;
+	UINT16 *reg = regsOf(regs);
 
-	for (vector<reg_t>::iterator it = regs->read.begin(); it != regs->read.end(); it++)
+	for (UINT16 *end = reg + regs->numRead; reg != end; reg++)
 	{
-		reg_t reg = *it;
-
-		if (lastInsPointer[reg] > 0)
+		if (ts->lastInsPointer[*reg] > 0)
 		{
 			// Compute the dependency distance
-			INT32 distance = insPointer - lastInsPointer[reg];
+			UINT64 distance = insPointer - ts->lastInsPointer[*reg];
+
+			// Populate the insDependDistance histogram
+			ts->insDependDistance->add(distance);
+
+			if (hotSpots && distance <= (UINT64)maxSize)
+				ts->hotPairs->add(ts->lastWriterPc[*reg], regs->pc);
+		}
+	}
 
-			// Populate the insDependDistance array
-			if (distance <= maxSize)
-				insDependDistance[distance - 1]++;
+	for (UINT16 *end = reg + regs->numWrite; reg != end; reg++)
+	{
+		if (trackFalseDeps)
+		{
+			// The instruction's own reads do not count as earlier reads
+			if (ts->lastReadPointer[*reg] > 0)
+				ts->warDependDistance->add(insPointer - ts->lastReadPointer[*reg]);
+			if (ts->lastInsPointer[*reg] > 0)
+				ts->wawDependDistance->add(insPointer - ts->lastInsPointer[*reg]);
 		}
+
+		ts->lastInsPointer[*reg] = insPointer;
+
+		if (hotSpots)
+			ts->lastWriterPc[*reg] = regs->pc;
+	}
+
+	if (trackFalseDeps)
+	{
+		for (UINT16 *reg = regsOf(regs); reg != regsOf(regs) + regs->numRead; reg++)
+			ts->lastReadPointer[*reg] = insPointer;
 	}
 
-	for (vector<reg_t>::iterator it = regs->write.begin(); it != regs->write.end(); it++)
-		lastInsPointer[*it] = insPointer;	
+	if (estimateIlp)
+		updateIlp(ts, regs);
+
+	if (insPointer >= ts->nextSnapshot)
+		WriteSnapshot(ts);
+}
+
+// This function is called before every instrumented run of a basic block.
+// It resolves the dependencies that cross the run boundary and advances
+// insPointer by the length of the run.
+VOID updateBlockDependDistance(THREADID tid, VOID *v)
+{
+	ThreadState *ts = (ThreadState*)PIN_GetThreadData(tlsKey, tid);
+	BlockDeps *deps = (BlockDeps*)v;
+	UINT64 base = ts->insPointer;
+
+	RegSet **insRegs = insRegsOf(deps);
+
+	RegIdx *ri = extReadOf(deps);
+	for (RegIdx *end = ri + deps->numExtRead; ri != end; ri++)
+	{
+		if (ts->lastInsPointer[ri->reg] > 0)
+		{
+			UINT64 distance = base + ri->idx - ts->lastInsPointer[ri->reg];
+
+			ts->insDependDistance->add(distance);
+
+			if (hotSpots && distance <= (UINT64)maxSize)
+				ts->hotPairs->add(ts->lastWriterPc[ri->reg], insRegs[ri->idx - 1]->pc);
+		}
+	}
+
+	if (trackFalseDeps)
+	{
+		// Resolved against the register timestamps from before the run
+		for (RegIdx *wi = extWarOf(deps); wi != extWarOf(deps) + deps->numExtWar; wi++)
+			if (ts->lastReadPointer[wi->reg] > 0)
+				ts->warDependDistance->add(base + wi->idx - ts->lastReadPointer[wi->reg]);
+
+		for (RegIdx *wi = extWawOf(deps); wi != extWawOf(deps) + deps->numExtWaw; wi++)
+			if (ts->lastInsPointer[wi->reg] > 0)
+				ts->wawDependDistance->add(base + wi->idx - ts->lastInsPointer[wi->reg]);
+
+		for (RegIdx *li = lastReadOf(deps); li != lastReadOf(deps) + deps->numLastRead; li++)
+			ts->lastReadPointer[li->reg] = base + li->idx;
+
+		for (LocalDep *dep = localWarOf(deps); dep != localWarOf(deps) + deps->numLocalWar; dep++)
+			ts->warDependDistance->add(dep->dist);
+
+		for (LocalDep *dep = localWawOf(deps); dep != localWawOf(deps) + deps->numLocalWaw; dep++)
+			ts->wawDependDistance->add(dep->dist);
+	}
+
+	ri = lastWriteOf(deps);
+	for (RegIdx *end = ri + deps->numLastWrite; ri != end; ri++)
+	{
+		ts->lastInsPointer[ri->reg] = base + ri->idx;
+
+		if (hotSpots)
+			ts->lastWriterPc[ri->reg] = insRegs[ri->idx - 1]->pc;
+	}
+
+	LocalDep *dep = localDepsOf(deps);
+	for (LocalDep *end = dep + deps->numLocal; dep != end; dep++)
+	{
+		ts->insDependDistance->add(dep->dist);
+
+		if (hotSpots && dep->dist <= maxSize)
+			ts->hotPairs->add(insRegs[dep->idx - dep->dist - 1]->pc, insRegs[dep->idx - 1]->pc);
+	}
+
+	ts->insPointer = base + deps->numIns;
+
+	if (estimateIlp)
+	{
+		for (RegSet **regs = insRegs; regs != insRegs + deps->numIns; regs++)
+			updateIlp(ts, *regs);
+	}
+
+	if (ts->insPointer >= ts->nextSnapshot)
+		WriteSnapshot(ts);
+}
+
+// This function is called before every memory read when memory dependencies
+// are tracked. back is the number of instructions of the current run that
+// follow the reading one, so the reader's index is insPointer - back.
+VOID readMemory(THREADID tid, ADDRINT addr, UINT32 size, UINT32 back)
+{
+	ThreadState *ts = (ThreadState*)PIN_GetThreadData(tlsKey, tid);
+
+	UINT64 writer = ts->shadow->lastWriter(addr, size);
+	if (writer > 0)
+	{
+		UINT64 distance = ts->insPointer - back - writer;
+
+		ts->memDependDistance->add(distance);
+	}
+}
+
+// This function is called before every memory write when memory dependencies are tracked
+VOID writeMemory(THREADID tid, ADDRINT addr, UINT32 size, UINT32 back)
+{
+	ThreadState *ts = (ThreadState*)PIN_GetThreadData(tlsKey, tid);
+	ts->shadow->write(addr, size, ts->insPointer - back);
+}
+
+// Insert the memory dependency calls of ins: reads first, then writes.
+// Must be called after the register analysis call of ins has been inserted.
+VOID InsertMemoryCalls(INS ins, UINT32 back)
+{
+	UINT32 memOps = INS_MemoryOperandCount(ins);
+
+	for (UINT32 op = 0; op < memOps; op++)
+		if (INS_MemoryOperandIsRead(ins, op))
+			INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)readMemory, IARG_THREAD_ID,
+				IARG_MEMORYOP_EA, op, IARG_UINT32, INS_MemoryOperandSize(ins, op), IARG_UINT32, back, IARG_END);
+
+	for (UINT32 op = 0; op < memOps; op++)
+		if (INS_MemoryOperandIsWritten(ins, op))
+			INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR)writeMemory, IARG_THREAD_ID,
+				IARG_MEMORYOP_EA, op, IARG_UINT32, INS_MemoryOperandSize(ins, op), IARG_UINT32, back, IARG_END);
+}
+
+// Return the packed register set of ins, building it on first sight
+RegSet* getRegSet(INS ins)
+{
+	std::map<ADDRINT, RegSet*>::iterator found = insDescs.find(INS_Address(ins));
+	if (found != insDescs.end())
+		return found->second;
+
+	RegSet *rs = newRegSet(ins, descArena);
+
+	std::map<string, UINT16>::iterator lat = opLatency.find(INS_Mnemonic(ins));
+	if (lat != opLatency.end())
+		rs->latency = lat->second;
+
+	if (hotSpots)
+	{
+		InsInfo &info = insInfos[INS_Address(ins)];
+		info.disasm = INS_Disassemble(ins);
+
+		RTN rtn = INS_Rtn(ins);
+		if (RTN_Valid(rtn))
+		{
+			info.rtn = RTN_Name(rtn);
+			info.img = IMG_Name(SEC_Img(RTN_Sec(rtn)));
+		}
+	}
+
+	insDescs[INS_Address(ins)] = rs;
+	return rs;
 }
 
 // Pin calls this function every time a new instruction is hencountered
 VOID Instruction(INS ins, VOID *v)
 {
+	if (!ROI_Active())
+		return;
+
 	// regs stores the registers read, written by this instruction
-	Registers* regs = new Registers();
+	RegSet* regs = getRegSet(ins);
+
+	// Insert a call to the analysis function -- updateInsDependDistance -- before every instruction.
+	// Pass the regs structure to the analysis function.
+	INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)updateInsDependDistance, IARG_THREAD_ID, IARG_PTR, (void*)regs, IARG_END);
+
+	if (trackMemory)
+		InsertMemoryCalls(ins, 0);
+}
+
+// Return the dependency summary of the run [head, tail) of a basic block,
+// building it on first sight
+BlockDeps* getBlockDeps(INS head, INS tail)
+{
+	UINT32 numIns = 0;
+	for (INS ins = head; ins != tail; ins = INS_Next(ins))
+		numIns++;
+
+	std::pair<ADDRINT, UINT32> key(INS_Address(head), numIns);
+	std::map<std::pair<ADDRINT, UINT32>, BlockDeps*>::iterator found = blockDescs.find(key);
+	if (found != blockDescs.end())
+		return found->second;
 
-	// Find all the register written
-	for (uint32_t iw = 0; iw < INS_MaxNumWRegs(ins); iw++)
+	vector<RegIdx> extRead, extWar, extWaw;
+	vector<LocalDep> localDeps, localWar, localWaw;
+	vector<RegSet*> insRegs;
+	UINT16 lastWrite[1024] = { 0 };
+	UINT16 lastRead[1024] = { 0 };
+
+	UINT16 idx = 0;
+	for (INS ins = head; ins != tail; ins = INS_Next(ins))
 	{
-		// 获取当前指令中被写的寄存器(即目的寄存器)
-		REG wr = INS_RegW(ins, iw);
-		// 获取寄存器名
-		wr = REG_FullRegName(wr);
-		if (!REG_valid(wr))
-			continue;
-    
-    	// 将被写寄存器保存到regs向量当中
-		if (std::find(regs->write.begin(), regs->write.end(), wr) == regs->write.end())
-			regs->write.push_back(wr);
+		RegSet *regs = getRegSet(ins);
+		UINT16 *reg = regsOf(regs);
+		insRegs.push_back(regs);
+		idx++;
+
+		for (UINT16 *end = reg + regs->numRead; reg != end; reg++)
+		{
+			if (lastWrite[*reg] == 0)
+			{
+				RegIdx ri = { *reg, idx };
+				extRead.push_back(ri);
+			}
+			else
+			{
+				LocalDep dep = { idx, (UINT16)(idx - lastWrite[*reg]) };
+				localDeps.push_back(dep);
+			}
+		}
+
+		for (UINT16 *end = reg + regs->numWrite; reg != end; reg++)
+		{
+			if (trackFalseDeps)
+			{
+				RegIdx ri = { *reg, idx };
+
+				if (lastRead[*reg] == 0)
+					extWar.push_back(ri);
+				else
+				{
+					LocalDep dep = { idx, (UINT16)(idx - lastRead[*reg]) };
+					localWar.push_back(dep);
+				}
+
+				if (lastWrite[*reg] == 0)
+					extWaw.push_back(ri);
+				else
+				{
+					LocalDep dep = { idx, (UINT16)(idx - lastWrite[*reg]) };
+					localWaw.push_back(dep);
+				}
+			}
+
+			lastWrite[*reg] = idx;
+		}
+
+		for (reg = regsOf(regs); reg != regsOf(regs) + regs->numRead; reg++)
+			lastRead[*reg] = idx;
 	}
 
-	// Find all the registers read
-	for (uint32_t ir = 0; ir < INS_MaxNumRRegs(ins); ir++)
+	vector<RegIdx> lastWrites, lastReads;
+	for (UINT16 reg = 0; reg < 1024; reg++)
 	{
-		REG rr = INS_RegR(ins, ir);
-		rr = REG_FullRegName(rr);
-		if (!REG_valid(rr)) {
-			continue;
+		if (lastWrite[reg] > 0)
+		{
+			RegIdx ri = { reg, lastWrite[reg] };
+			lastWrites.push_back(ri);
 		}
 
-		if (std::find(regs->read.begin(), regs->read.end(), rr) == regs->read.end()) {
-			regs->read.push_back(rr);
+		if (trackFalseDeps && lastRead[reg] > 0)
+		{
+			RegIdx ri = { reg, lastRead[reg] };
+			lastReads.push_back(ri);
 		}
 	}
 
-	// Insert a call to the analysis function -- updateInsDependDistance -- before every instruction.
-	// Pass the regs structure to the analysis function.
-	INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)updateInsDependDistance, IARG_PTR, (void*)regs, IARG_END);
+	BlockDeps *deps = (BlockDeps*)descArena.alloc(sizeof(BlockDeps)
+		+ (extRead.size() + lastWrites.size() + extWar.size() + extWaw.size() + lastReads.size()) * sizeof(RegIdx)
+		+ (localDeps.size() + localWar.size() + localWaw.size()) * sizeof(LocalDep)
+		+ sizeof(RegSet*) - 1 + insRegs.size() * sizeof(RegSet*));
+	deps->numIns = numIns;
+	deps->numExtRead = extRead.size();
+	deps->numLastWrite = lastWrites.size();
+	deps->numExtWar = extWar.size();
+	deps->numExtWaw = extWaw.size();
+	deps->numLastRead = lastReads.size();
+	deps->numLocal = localDeps.size();
+	deps->numLocalWar = localWar.size();
+	deps->numLocalWaw = localWaw.size();
+
+	std::copy(extRead.begin(), extRead.end(), extReadOf(deps));
+	std::copy(lastWrites.begin(), lastWrites.end(), lastWriteOf(deps));
+	std::copy(extWar.begin(), extWar.end(), extWarOf(deps));
+	std::copy(extWaw.begin(), extWaw.end(), extWawOf(deps));
+	std::copy(lastReads.begin(), lastReads.end(), lastReadOf(deps));
+	std::copy(localDeps.begin(), localDeps.end(), localDepsOf(deps));
+	std::copy(localWar.begin(), localWar.end(), localWarOf(deps));
+	std::copy(localWaw.begin(), localWaw.end(), localWawOf(deps));
+	std::copy(insRegs.begin(), insRegs.end(), insRegsOf(deps));
+
+	blockDescs[key] = deps;
+	return deps;
+}
+
+// Insert the analysis call for the run [head, tail) of a basic block
+VOID InsertBlockCall(INS head, INS tail)
+{
+	BlockDeps* deps = getBlockDeps(head, tail);
+	INS_InsertCall(head, IPOINT_BEFORE, (AFUNPTR)updateBlockDependDistance, IARG_THREAD_ID, IARG_PTR, (void*)deps, IARG_END);
+
+	if (trackMemory)
+	{
+		UINT32 back = deps->numIns;
+		for (INS ins = head; ins != tail; ins = INS_Next(ins))
+			InsertMemoryCalls(ins, --back);
+	}
+}
+
+// Pin calls this function every time a new trace is encountered
+VOID Trace(TRACE trace, VOID *v)
+{
+	if (!ROI_Active())
+		return;
+
+	for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+	{
+		// Split the block at REP-prefixed instructions: Pin executes their
+		// IPOINT_BEFORE call once per iteration, so they keep a call of their own.
+		INS head = BBL_InsHead(bbl);
+		for (INS ins = head; INS_Valid(ins); ins = INS_Next(ins))
+		{
+			if (!INS_HasRealRep(ins))
+				continue;
+
+			if (head != ins)
+				InsertBlockCall(head, ins);
+			Instruction(ins, 0);
+			head = INS_Next(ins);
+		}
+
+		if (INS_Valid(head))
+			InsertBlockCall(head, INS_Invalid());
+	}
 }
 
 // This knob sets the output file name
@@ -115,14 +545,225 @@ KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o", "insDependDist.
 // This knob will set the maximum distance between two dependant instructions in the program
 KNOB<string> KnobMaxDistance(KNOB_MODE_WRITEONCE, "pintool", "s", "100", "specify the maximum distance between two dependant instructions in the program");
 
+// This knob selects basic-block-level instrumentation (one analysis call per block)
+KNOB<BOOL> KnobBlockMode(KNOB_MODE_WRITEONCE, "pintool", "bbl", "1", "instrument per basic block instead of per instruction");
+
+// This knob enables tracking of store-to-load (memory RAW) dependencies
+KNOB<BOOL> KnobMemory(KNOB_MODE_WRITEONCE, "pintool", "m", "0", "also track memory dependencies (second line of the output)");
+
+// This knob enables the write-after-read and write-after-write histograms
+KNOB<BOOL> KnobFalseDeps(KNOB_MODE_WRITEONCE, "pintool", "f", "0", "also measure WAR and WAW distances (two more lines after the RAW ones)");
+
+// This knob appends log2 buckets of the distances above the maximum to every histogram
+KNOB<BOOL> KnobTail(KNOB_MODE_WRITEONCE, "pintool", "l", "0", "append log2 buckets of the distances beyond -s to the histograms");
+
+// These knobs control the streaming interval snapshots
+KNOB<UINT64> KnobInterval(KNOB_MODE_WRITEONCE, "pintool", "i", "0", "write a histogram snapshot every N instructions of a thread (0: off)");
+KNOB<string> KnobIntervalFile(KNOB_MODE_WRITEONCE, "pintool", "io", "insDependDist.interval.csv", "specify the interval snapshot file name");
+
+// These knobs control the per-instruction hot-spot report
+KNOB<UINT32> KnobHotSpots(KNOB_MODE_WRITEONCE, "pintool", "hot", "0", "report the N (producer, consumer) instruction pairs with the most dependencies within -s");
+KNOB<string> KnobHotFile(KNOB_MODE_WRITEONCE, "pintool", "hot_o", "insDependDist.hot.csv", "specify the hot-spot report file name");
+
+// These knobs control the dataflow-limit ILP estimation
+KNOB<BOOL> KnobIlp(KNOB_MODE_WRITEONCE, "pintool", "ilp", "0", "estimate the achievable IPC of a dataflow machine");
+KNOB<string> KnobIlpWindows(KNOB_MODE_WRITEONCE, "pintool", "w", "32,64,128,256", "specify the instruction window sizes of the ILP estimation");
+KNOB<string> KnobIlpLatency(KNOB_MODE_WRITEONCE, "pintool", "lat", "", "specify a file of \"MNEMONIC latency\" lines (1 cycle by default)");
+KNOB<string> KnobIlpOutputFile(KNOB_MODE_WRITEONCE, "pintool", "ilp_o", "insDependDist.ilp.csv", "specify the ILP output file name");
+
+// This function is called when a thread starts: allocate its private state
+VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+	ThreadState *ts = new ThreadState();
+	ts->insPointer = 0;
+	memset(ts->lastInsPointer, 0, sizeof(ts->lastInsPointer));
+	memset(ts->lastReadPointer, 0, sizeof(ts->lastReadPointer));
+	ts->insDependDistance = new DistHist(maxSize);
+	ts->memDependDistance = NULL;
+	ts->shadow = NULL;
+
+	if (trackMemory)
+	{
+		ts->memDependDistance = new DistHist(maxSize);
+		ts->shadow = new ShadowMemory();
+	}
+
+	ts->warDependDistance = NULL;
+	ts->wawDependDistance = NULL;
+
+	if (trackFalseDeps)
+	{
+		ts->warDependDistance = new DistHist(maxSize);
+		ts->wawDependDistance = new DistHist(maxSize);
+	}
+
+	ts->nextSnapshot = ~0ULL;
+	ts->lastInsSnapshot = NULL;
+	ts->lastMemSnapshot = NULL;
+	ts->lastWarSnapshot = NULL;
+	ts->lastWawSnapshot = NULL;
+
+	if (snapshotInterval > 0)
+	{
+		ts->nextSnapshot = snapshotInterval;
+		ts->lastInsSnapshot = new DistHist(maxSize);
+		if (trackMemory)
+			ts->lastMemSnapshot = new DistHist(maxSize);
+		if (trackFalseDeps)
+		{
+			ts->lastWarSnapshot = new DistHist(maxSize);
+			ts->lastWawSnapshot = new DistHist(maxSize);
+		}
+	}
+
+	memset(ts->lastWriterPc, 0, sizeof(ts->lastWriterPc));
+	ts->hotPairs = hotSpots ? new PairTable() : NULL;
+
+	ts->ilp = NULL;
+	ts->ilpInsCount = 0;
+	ts->tid = tid;
+
+	if (estimateIlp)
+	{
+		ts->ilp = new IlpWindow[ilpWindows.size()];
+		for (size_t i = 0; i < ilpWindows.size(); i++)
+		{
+			IlpWindow *w = &ts->ilp[i];
+			w->size = ilpWindows[i];
+			memset(w->regReady, 0, sizeof(w->regReady));
+			w->retire = new UINT64[w->size];
+			memset(w->retire, 0, sizeof(UINT64) * w->size);
+			w->lastRetire = 0;
+		}
+	}
+
+	PIN_SetThreadData(tlsKey, ts, tid);
+
+	// The state outlives the thread so that Fini can merge its histogram
+	PIN_GetLock(&threadsLock, tid + 1);
+	threadStates.push_back(ts);
+	PIN_ReleaseLock(&threadsLock);
+}
+
+// Write the achievable IPC of every thread and window size, plus the
+// combined figure of all threads (total instructions over total cycles)
+VOID WriteIlp()
+{
+	ofstream IlpFile(KnobIlpOutputFile.Value().c_str());
+	IlpFile << "thread,window,instructions,cycles,ipc" << endl;
+
+	for (size_t i = 0; i < ilpWindows.size(); i++)
+	{
+		UINT64 instructions = 0, cycles = 0;
+
+		for (size_t t = 0; t < threadStates.size(); t++)
+		{
+			ThreadState *ts = threadStates[t];
+			IlpWindow *w = &ts->ilp[i];
+
+			IlpFile << ts->tid << "," << w->size << "," << ts->ilpInsCount << "," << w->lastRetire << ","
+				<< (w->lastRetire ? (double)ts->ilpInsCount / w->lastRetire : 0) << endl;
+			instructions += ts->ilpInsCount;
+			cycles += w->lastRetire;
+		}
+
+		IlpFile << "all," << ilpWindows[i] << "," << instructions << "," << cycles << ","
+			<< (cycles ? (double)instructions / cycles : 0) << endl;
+	}
+
+	IlpFile.close();
+}
+
+// Write the hotSpots (producer, consumer) pairs with the most dependencies within -s
+VOID WriteHotSpots()
+{
+	PairTable all;
+	for (size_t t = 0; t < threadStates.size(); t++)
+		all.merge(*threadStates[t]->hotPairs);
+
+	ofstream HotFile(KnobHotFile.Value().c_str());
+	HotFile << "count,producer,consumer,producer disassembly,consumer disassembly,routine,image" << endl;
+
+	vector<std::pair<UINT64, std::pair<ADDRINT, ADDRINT> > > top = all.top(hotSpots);
+	for (size_t i = 0; i < top.size(); i++)
+	{
+		const InsInfo &producer = insInfos[top[i].second.first];
+		const InsInfo &consumer = insInfos[top[i].second.second];
+
+		HotFile << top[i].first << "," << std::hex << "0x" << top[i].second.first << ",0x" << top[i].second.second
+			<< std::dec << ",\"" << producer.disasm << "\",\"" << consumer.disasm << "\","
+			<< consumer.rtn << "," << consumer.img << endl;
+	}
+
+	HotFile.close();
+}
+
+// Load "MNEMONIC latency" lines into opLatency; '#' starts a comment
+VOID LoadLatencies(const string &fileName)
+{
+	std::ifstream in(fileName.c_str());
+	string line;
+
+	while (std::getline(in, line))
+	{
+		std::istringstream fields(line.substr(0, line.find('#')));
+		string mnemonic;
+		UINT32 latency;
+
+		if (fields >> mnemonic >> latency)
+			opLatency[mnemonic] = latency;
+	}
+}
+
 // This function is called when the application exits
 VOID Fini(INT32 code, VOID *v)
 {
+	// Merge the per-thread histograms
+	for (size_t t = 0; t < threadStates.size(); t++)
+	{
+		insDependDistance->merge(*threadStates[t]->insDependDistance);
+
+		if (trackMemory)
+			memDependDistance->merge(*threadStates[t]->memDependDistance);
+
+		if (trackFalseDeps)
+		{
+			warDependDistance->merge(*threadStates[t]->warDependDistance);
+			wawDependDistance->merge(*threadStates[t]->wawDependDistance);
+		}
+
+		// Flush the last, partial interval
+		if (snapshotInterval > 0)
+			WriteSnapshot(threadStates[t]);
+	}
+	SnapshotFile.close();
+
 	// Write to a file since cout and cerr maybe closed by the application
     OutFile.setf(ios::showbase);
-    for (INT32 i = 0; i < maxSize; i++)
-	    OutFile << insDependDistance[i] << ",";
+    insDependDistance->write(OutFile, writeTail);
+
+    // The memory dependency histogram goes on a second line
+    if (trackMemory)
+    {
+        OutFile << endl;
+        memDependDistance->write(OutFile, writeTail);
+    }
+
+    // Followed by the WAR and WAW histograms
+    if (trackFalseDeps)
+    {
+        OutFile << endl;
+        warDependDistance->write(OutFile, writeTail);
+        OutFile << endl;
+        wawDependDistance->write(OutFile, writeTail);
+    }
     OutFile.close();
+
+    if (estimateIlp)
+        WriteIlp();
+
+    if (hotSpots)
+        WriteHotSpots();
 }
 
 /* ===================================================================== */
@@ -146,16 +787,52 @@ int main(int argc, char * argv[])
 {
     // Initialize pin
     if (PIN_Init(argc, argv)) return Usage();
+    ROI_Init();
     
     OutFile.open(KnobOutputFile.Value().c_str());
     maxSize = atoi(KnobMaxDistance.Value().c_str());
 
     // Initializing depdendancy Distance
-    insDependDistance = new UINT64[maxSize];
-    memset((void*)insDependDistance, 0, sizeof(UINT64) * maxSize);
+    insDependDistance = new DistHist(maxSize);
+    writeTail = KnobTail.Value();
+
+    // Window sizes and latencies of the ILP estimation
+    estimateIlp = KnobIlp.Value();
+    std::istringstream windows(KnobIlpWindows.Value());
+    for (string w; std::getline(windows, w, ','); )
+        if (atoi(w.c_str()) > 0)
+            ilpWindows.push_back(atoi(w.c_str()));
+    if (!KnobIlpLatency.Value().empty())
+        LoadLatencies(KnobIlpLatency.Value());
+
+    // Routine names are needed by the hot-spot report
+    hotSpots = KnobHotSpots.Value();
+    if (hotSpots)
+        PIN_InitSymbols();
+
+    trackMemory = KnobMemory.Value();
+    memDependDistance = new DistHist(maxSize);
+
+    trackFalseDeps = KnobFalseDeps.Value();
+    warDependDistance = new DistHist(maxSize);
+    wawDependDistance = new DistHist(maxSize);
+
+    // Interval snapshots
+    snapshotInterval = KnobInterval.Value();
+    if (snapshotInterval > 0)
+        SnapshotFile.open(KnobIntervalFile.Value().c_str());
+    PIN_InitLock(&snapshotLock);
+
+    // Per-thread state lives in Pin TLS
+    tlsKey = PIN_CreateThreadDataKey(NULL);
+    PIN_InitLock(&threadsLock);
+    PIN_AddThreadStartFunction(ThreadStart, 0);
 
-    // Register Instruction to be called to instrument instructions
-    INS_AddInstrumentFunction(Instruction, 0);
+    // Register Trace (or Instruction) to be called to instrument the code
+    if (KnobBlockMode.Value())
+        TRACE_AddInstrumentFunction(Trace, 0);
+    else
+        INS_AddInstrumentFunction(Instruction, 0);
 
     // Register Fini to be called when the application exits
     PIN_AddFiniFunction(Fini, 0);
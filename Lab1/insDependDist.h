@@ -0,0 +1,454 @@
+// Data structures shared by the register/memory dependency trackers:
+// packed per-instruction and per-block descriptors, their arena, distance
+// histograms, shadow memory, the ILP window model and the PC-pair table.
+#ifndef INS_DEPEND_DIST_H
+#define INS_DEPEND_DIST_H
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include "pin.H"
+
+// Convenience data structure
+typedef uint32_t reg_t;
+struct Registers
+{
+	std::vector<reg_t> read;
+	std::vector<reg_t> write;
+};
+
+// Packed register-set descriptor of one instruction.
+// The header is followed by numRead read registers and numWrite written
+// registers (UINT16 each), so a typical instruction fits in one cache line.
+struct RegSet
+{
+	ADDRINT pc;             // Instruction address (hot-spot attribution)
+	UINT16 numRead;
+	UINT16 numWrite;
+	UINT16 latency;         // Execution latency in cycles (ILP estimation only)
+};
+
+inline UINT16* regsOf(RegSet *rs) { return (UINT16*)(rs + 1); }
+
+// A (register, instruction index) pair inside a block
+struct RegIdx
+{
+	UINT16 reg;
+	UINT16 idx;
+};
+
+// A dependency of instruction idx on instruction idx - dist of the same block
+struct LocalDep
+{
+	UINT16 idx;
+	UINT16 dist;
+};
+
+// Packed dependency summary of a run of instructions inside one basic block.
+// Dependencies whose producer lies in the same run have a distance that is
+// known at instrumentation time; only the reads produced outside the run and
+// the last write of every register have to be handled at run time.
+// The header is followed by numExtRead reads produced before the run,
+// numLastWrite last writes, numExtWar writes whose previous read lies before
+// the run, numExtWaw writes whose previous write lies before the run,
+// numLastRead last reads (all RegIdx), then numLocal read-after-write,
+// numLocalWar write-after-read and numLocalWaw write-after-write local
+// dependencies (LocalDep) and, aligned to a pointer, the numIns register
+// sets of the run. The WAR/WAW parts are empty unless false dependencies
+// are tracked.
+struct BlockDeps
+{
+	UINT16 numIns;          // Number of instructions in the run
+	UINT16 numExtRead;
+	UINT16 numLastWrite;
+	UINT16 numExtWar;
+	UINT16 numExtWaw;
+	UINT16 numLastRead;
+	UINT16 numLocal;
+	UINT16 numLocalWar;
+	UINT16 numLocalWaw;
+};
+
+inline RegIdx* extReadOf(BlockDeps *d) { return (RegIdx*)(d + 1); }
+inline RegIdx* lastWriteOf(BlockDeps *d) { return extReadOf(d) + d->numExtRead; }
+inline RegIdx* extWarOf(BlockDeps *d) { return lastWriteOf(d) + d->numLastWrite; }
+inline RegIdx* extWawOf(BlockDeps *d) { return extWarOf(d) + d->numExtWar; }
+inline RegIdx* lastReadOf(BlockDeps *d) { return extWawOf(d) + d->numExtWaw; }
+inline LocalDep* localDepsOf(BlockDeps *d) { return (LocalDep*)(lastReadOf(d) + d->numLastRead); }
+inline LocalDep* localWarOf(BlockDeps *d) { return localDepsOf(d) + d->numLocal; }
+inline LocalDep* localWawOf(BlockDeps *d) { return localWarOf(d) + d->numLocalWar; }
+inline RegSet** insRegsOf(BlockDeps *d)
+{
+	return (RegSet**)(((ADDRINT)(localWawOf(d) + d->numLocalWaw) + sizeof(RegSet*) - 1) & ~(ADDRINT)(sizeof(RegSet*) - 1));
+}
+
+// Bump allocator for the descriptors above.
+// Memory is handed out on cache-line boundaries and released only at exit.
+class Arena
+{
+	static const size_t CHUNK_SIZE = 64 * 1024;
+	static const size_t LINE_SIZE = 64;
+
+	std::vector<char*> m_chunks;
+	char* m_cur;
+	size_t m_left;
+
+	public:
+		Arena() : m_cur(NULL), m_left(0) {}
+		~Arena() { release(); }
+
+		void* alloc(size_t bytes)
+		{
+			bytes = (bytes + LINE_SIZE - 1) & ~(LINE_SIZE - 1);
+			if (bytes > m_left)
+			{
+				size_t size = bytes > CHUNK_SIZE ? bytes : CHUNK_SIZE;
+				char* chunk = new char[size + LINE_SIZE];
+				m_chunks.push_back(chunk);
+
+				m_cur = (char*)(((ADDRINT)chunk + LINE_SIZE - 1) & ~(ADDRINT)(LINE_SIZE - 1));
+				m_left = size;
+			}
+
+			void* p = m_cur;
+			m_cur += bytes;
+			m_left -= bytes;
+			return p;
+		}
+
+		void release()
+		{
+			for (size_t i = 0; i < m_chunks.size(); i++)
+				delete[] m_chunks[i];
+			m_chunks.clear();
+			m_cur = NULL;
+			m_left = 0;
+		}
+};
+
+// Histogram of dependency distances: exact counts for distances 1..size and
+// log2 buckets above it, so long-tail distances are kept at constant memory
+// cost instead of being dropped.
+class DistHist
+{
+	INT32 m_size;
+	UINT64* m_exact;        // m_exact[d - 1] counts distance d (d <= m_size)
+	UINT64 m_tail[64];      // m_tail[k] counts distances above m_size in [2^k, 2^(k+1))
+
+	public:
+		DistHist(INT32 size) : m_size(size)
+		{
+			m_exact = new UINT64[m_size];
+			memset(m_exact, 0, sizeof(UINT64) * m_size);
+			memset(m_tail, 0, sizeof(m_tail));
+		}
+
+		~DistHist() { delete[] m_exact; }
+
+		void add(UINT64 distance)
+		{
+			if (distance <= (UINT64)m_size)
+				m_exact[distance - 1]++;
+			else
+				m_tail[63 - __builtin_clzll(distance)]++;
+		}
+
+		void merge(const DistHist &h)
+		{
+			for (INT32 i = 0; i < m_size; i++)
+				m_exact[i] += h.m_exact[i];
+			for (int k = 0; k < 64; k++)
+				m_tail[k] += h.m_tail[k];
+		}
+
+		void copy(const DistHist &h)
+		{
+			memcpy(m_exact, h.m_exact, sizeof(UINT64) * m_size);
+			memcpy(m_tail, h.m_tail, sizeof(m_tail));
+		}
+
+		// Write the counts as CSV columns, minus those of prev if given.
+		// With withTail, the log2 buckets from the one holding size + 1 up
+		// to the last non-empty one follow the exact counts.
+		void write(std::ostream &out, bool withTail, const DistHist *prev = NULL) const
+		{
+			for (INT32 i = 0; i < m_size; i++)
+				out << m_exact[i] - (prev ? prev->m_exact[i] : 0) << ",";
+
+			if (!withTail)
+				return;
+
+			int first = 63 - __builtin_clzll((UINT64)m_size + 1), last = first;
+			for (int k = first; k < 64; k++)
+				if (m_tail[k] - (prev ? prev->m_tail[k] : 0) > 0)
+					last = k;
+			for (int k = first; k <= last; k++)
+				out << m_tail[k] - (prev ? prev->m_tail[k] : 0) << ",";
+		}
+};
+
+// Shadow memory recording the index of the last instruction writing every
+// 4-byte word. Words are reached through a three-level page table over a
+// 48-bit address space, so a lookup costs O(1) and pages are only allocated
+// for memory the application actually writes.
+class ShadowMemory
+{
+	static const UINT32 WORD_LOG = 2;
+	static const UINT32 LEAF_LOG = 16;      // Words per leaf page
+	static const UINT32 MID_LOG = 15;       // Leaf pages per middle page
+	static const UINT32 TOP_LOG = 48 - WORD_LOG - LEAF_LOG - MID_LOG;
+
+	UINT64*** m_top;
+	UINT64 m_last_page_no;                  // Page number of the most recently used leaf
+	UINT64* m_last_page;
+
+	UINT64* getPage(UINT64 page_no, bool create)
+	{
+		if (page_no == m_last_page_no)
+			return m_last_page;
+
+		UINT64 top = (page_no >> MID_LOG) & ((1ULL << TOP_LOG) - 1);
+		UINT64 mid = page_no & ((1ULL << MID_LOG) - 1);
+
+		if (m_top[top] == NULL)
+		{
+			if (!create)
+				return NULL;
+			m_top[top] = new UINT64* [1ULL << MID_LOG];
+			memset(m_top[top], 0, sizeof(UINT64*) << MID_LOG);
+		}
+
+		if (m_top[top][mid] == NULL)
+		{
+			if (!create)
+				return NULL;
+			m_top[top][mid] = new UINT64 [1ULL << LEAF_LOG];
+			memset(m_top[top][mid], 0, sizeof(UINT64) << LEAF_LOG);
+		}
+
+		m_last_page_no = page_no;
+		m_last_page = m_top[top][mid];
+		return m_last_page;
+	}
+
+	public:
+		ShadowMemory() : m_last_page_no(~0ULL), m_last_page(NULL)
+		{
+			m_top = new UINT64** [1ULL << TOP_LOG];
+			memset(m_top, 0, sizeof(UINT64**) << TOP_LOG);
+		}
+
+		~ShadowMemory()
+		{
+			for (UINT64 i = 0; i < (1ULL << TOP_LOG); i++)
+			{
+				if (m_top[i] == NULL)
+					continue;
+				for (UINT64 j = 0; j < (1ULL << MID_LOG); j++)
+					delete[] m_top[i][j];
+				delete[] m_top[i];
+			}
+			delete[] m_top;
+		}
+
+		// Return the index of the most recent writer of [addr, addr + size), 0 if none
+		UINT64 lastWriter(ADDRINT addr, UINT32 size)
+		{
+			UINT64 last = 0;
+			for (UINT64 w = addr >> WORD_LOG; w <= (addr + size - 1) >> WORD_LOG; w++)
+			{
+				UINT64* page = getPage(w >> LEAF_LOG, false);
+				if (page != NULL && page[w & ((1ULL << LEAF_LOG) - 1)] > last)
+					last = page[w & ((1ULL << LEAF_LOG) - 1)];
+			}
+			return last;
+		}
+
+		// Record insPointer as the last writer of [addr, addr + size)
+		void write(ADDRINT addr, UINT32 size, UINT64 insPointer)
+		{
+			for (UINT64 w = addr >> WORD_LOG; w <= (addr + size - 1) >> WORD_LOG; w++)
+				getPage(w >> LEAF_LOG, true)[w & ((1ULL << LEAF_LOG) - 1)] = insPointer;
+		}
+};
+
+// Dataflow-limit model of one instruction window size.
+// An instruction enters the window once the instruction `size` places older
+// has retired, issues when its source registers are ready, completes after
+// its latency and retires in order.
+struct IlpWindow
+{
+	UINT32 size;
+	UINT64 regReady[1024];              // Cycle at which each register's value is ready
+	UINT64 *retire;                     // Retire cycles of the last `size` instructions (ring)
+	UINT64 lastRetire;                  // Retire cycle of the youngest instruction
+};
+
+// Open-addressed table counting dependencies per (producer PC, consumer PC)
+// pair. The table doubles when half full; a zero producer marks a free slot.
+class PairTable
+{
+	struct Entry
+	{
+		ADDRINT producer;
+		ADDRINT consumer;
+		UINT64 count;
+	};
+
+	Entry* m_entries;
+	size_t m_mask;
+	size_t m_used;
+
+	Entry* find(ADDRINT producer, ADDRINT consumer)
+	{
+		size_t i = (producer * 0x9E3779B97F4A7C15ULL ^ consumer) * 0xC2B2AE3D27D4EB4FULL >> 20;
+		for (i &= m_mask; ; i = (i + 1) & m_mask)
+		{
+			Entry *e = &m_entries[i];
+			if (e->producer == 0 || (e->producer == producer && e->consumer == consumer))
+				return e;
+		}
+	}
+
+	void grow()
+	{
+		Entry* old = m_entries;
+		size_t oldSize = m_mask + 1;
+
+		m_mask = 2 * oldSize - 1;
+		m_entries = new Entry[m_mask + 1];
+		memset(m_entries, 0, sizeof(Entry) * (m_mask + 1));
+
+		for (size_t i = 0; i < oldSize; i++)
+			if (old[i].producer != 0)
+				*find(old[i].producer, old[i].consumer) = old[i];
+
+		delete[] old;
+	}
+
+	public:
+		PairTable(size_t size_log = 12) : m_mask((1ULL << size_log) - 1), m_used(0)
+		{
+			m_entries = new Entry[m_mask + 1];
+			memset(m_entries, 0, sizeof(Entry) * (m_mask + 1));
+		}
+
+		~PairTable() { delete[] m_entries; }
+
+		void add(ADDRINT producer, ADDRINT consumer, UINT64 count = 1)
+		{
+			Entry *e = find(producer, consumer);
+			if (e->producer == 0)
+			{
+				if (2 * (m_used + 1) > m_mask + 1)
+				{
+					grow();
+					e = find(producer, consumer);
+				}
+
+				e->producer = producer;
+				e->consumer = consumer;
+				m_used++;
+			}
+			e->count += count;
+		}
+
+		void merge(const PairTable &t)
+		{
+			for (size_t i = 0; i <= t.m_mask; i++)
+				if (t.m_entries[i].producer != 0)
+					add(t.m_entries[i].producer, t.m_entries[i].consumer, t.m_entries[i].count);
+		}
+
+		// Return the n pairs with the highest counts as (count, (producer, consumer))
+		std::vector<std::pair<UINT64, std::pair<ADDRINT, ADDRINT> > > top(size_t n) const
+		{
+			std::vector<std::pair<UINT64, std::pair<ADDRINT, ADDRINT> > > pairs;
+			for (size_t i = 0; i <= m_mask; i++)
+				if (m_entries[i].producer != 0)
+					pairs.push_back(std::make_pair(m_entries[i].count,
+						std::make_pair(m_entries[i].producer, m_entries[i].consumer)));
+
+			n = std::min(n, pairs.size());
+			std::partial_sort(pairs.begin(), pairs.begin() + n, pairs.end(),
+				std::greater<std::pair<UINT64, std::pair<ADDRINT, ADDRINT> > >());
+			pairs.resize(n);
+			return pairs;
+		}
+};
+
+// Collect the (full-width, de-duplicated) registers read and written by ins
+inline VOID getRegisters(INS ins, Registers *regs)
+{
+	// Find all the register written
+	for (uint32_t iw = 0; iw < INS_MaxNumWRegs(ins); iw++)
+	{
+		// 获取当前指令中被写的寄存器(即目的寄存器)
+		REG wr = INS_RegW(ins, iw);
+		// 获取寄存器名
+		wr = REG_FullRegName(wr);
+		if (!REG_valid(wr))
+			continue;
+    
+    	// 将被写寄存器保存到regs向量当中
+		if (std::find(regs->write.begin(), regs->write.end(), wr) == regs->write.end())
+			regs->write.push_back(wr);
+	}
+
+	// Find all the registers read
+	for (uint32_t ir = 0; ir < INS_MaxNumRRegs(ins); ir++)
+	{
+		REG rr = INS_RegR(ins, ir);
+		rr = REG_FullRegName(rr);
+		if (!REG_valid(rr)) {
+			continue;
+		}
+
+		if (std::find(regs->read.begin(), regs->read.end(), rr) == regs->read.end()) {
+			regs->read.push_back(rr);
+		}
+	}
+}
+
+// Pack the registers of ins into a register set allocated from arena;
+// the latency is 1 cycle
+inline RegSet* newRegSet(INS ins, Arena &arena)
+{
+	Registers regs;
+	getRegisters(ins, &regs);
+
+	size_t num = regs.read.size() + regs.write.size();
+	RegSet *rs = (RegSet*)arena.alloc(sizeof(RegSet) + num * sizeof(UINT16));
+	rs->pc = INS_Address(ins);
+	rs->numRead = regs.read.size();
+	rs->numWrite = regs.write.size();
+	rs->latency = 1;
+
+	UINT16 *reg = regsOf(rs);
+	for (size_t i = 0; i < regs.read.size(); i++)
+		*reg++ = regs.read[i];
+	for (size_t i = 0; i < regs.write.size(); i++)
+		*reg++ = regs.write[i];
+
+	return rs;
+}
+
+// Add the distances from the registers read by instruction insPointer to
+// their last writers to hist, then record it as the last writer of the
+// registers it writes
+inline VOID addRegDependDistance(UINT64 insPointer, UINT64 *lastInsPointer, RegSet *regs, DistHist *hist)
+{
+	UINT16 *reg = regsOf(regs);
+
+	for (UINT16 *end = reg + regs->numRead; reg != end; reg++)
+	{
+		if (lastInsPointer[*reg] > 0)
+			hist->add(insPointer - lastInsPointer[*reg]);
+	}
+
+	for (UINT16 *end = reg + regs->numWrite; reg != end; reg++)
+		lastInsPointer[*reg] = insPointer;
+}
+
+#endif // INS_DEPEND_DIST_H
@@ -1,616 +1,464 @@
 #include <iostream>
 #include <fstream>
+#include <iomanip>
+#include <sstream>
 #include <cassert>
 #include <stdarg.h>
 #include <cstdlib>
 #include <cstring>
 #include "pin.H"
+#include "../Common/roi.h"
+#include "brchTrace.h"
+#include "brchPredict.h"
+#include "targetPredict.h"
 
 using namespace std;
 
-typedef unsigned char       UINT8;
-typedef unsigned short      UINT16;
-typedef unsigned int        UINT32;
-typedef unsigned long int   UINT64;
-typedef unsigned __int128   UINT128;
-
-
-
 ofstream OutFile;
 
-// 将val截断, 使其宽度变成bits
-#define truncate(val, bits) ((val) & ((1 << (bits)) - 1))
-
-static UINT64 takenCorrect = 0;
-static UINT64 takenIncorrect = 0;
-static UINT64 notTakenCorrect = 0;
-static UINT64 notTakenIncorrect = 0;
-
-// 饱和计数器 (N < 64)
-class SaturatingCnt
+// Each thread predicts with a bank of its own. With -shared 1 the banks
+// share the tables of these predictors, as the threads of an SMT core
+// share the front end: each thread keeps its history and update queue, and
+// the tables are updated racily, without a lock. Without -shared this bank
+// stays empty.
+PredictorBank bank;
+bool sharedTables = false;
+
+// Per-branch outcomes of the first predictor, for the hard branch report (-top)
+BranchProfile profile;
+bool profileBranches = false;
+
+// Capture mode (-trace): one trace per thread
+bool captureTrace = false;
+
+// Checkpoint the threads start from (-ckpt_load)
+string warmState;
+
+// Target prediction (-targets); the BTB and the ITTAGE tables shared with -shared 1
+bool predictTargets = false;
+BTB* sharedBTB = NULL;
+ITTAGEPredictor* sharedITTAGE = NULL;
+
+// Time series (-interval): accuracy and MPKI every sampleInterval instructions
+// of a thread, streamed to the CSV file
+UINT64 sampleInterval = 0;
+ofstream SampleFile;
+PIN_LOCK sampleLock;
+
+// State of one application thread, kept in Pin TLS so that the analysis
+// routine takes no lock; only shared tables are raced on
+struct ThreadState
 {
-    size_t m_wid;
-    UINT8 m_val;
-    const UINT8 m_init_val;
+    PredictorBank bank;
+    THREADID tid;
+    BranchProfile profile;
+    BranchTraceWriter* trace;
+    string traceName;
+
+    BTB* btb;
+    ITTAGEPredictor* ittage;
+    ReturnStack* ras;               // Always per thread, as in hardware
+    TargetStats btbStats;
+    TargetStats ittageStats;
+    TargetStats rasStats;
+
+    UINT64 insCount;                // Instructions executed in the ROI
+    UINT64 nextSample;              // Instruction count of the next sample
+    UINT64 lastSampleIns;
+    vector<BranchStats> lastSample; // Stats at the previous sample
+};
 
-    public:
-        SaturatingCnt(size_t width = 2) : m_init_val((1 << width) / 2)
-        {
-            m_wid = width;
-            m_val = m_init_val;
-        }
+TLS_KEY tlsKey;
+PIN_LOCK threadsLock;
+vector<ThreadState*> threadStates; // Kept until Fini, even after the thread exits
 
-        void increase() { if (m_val < (1 << m_wid) - 1) m_val++; }
-        void decrease() { if (m_val > 0) m_val--; }
+// This function is called every time a control-flow instruction is encountered
+void predictBranch(THREADID tid, ADDRINT pc, BOOL direction)
+{
+    ThreadState* ts = (ThreadState*)PIN_GetThreadData(tlsKey, tid);
+    bool predicted = ts->bank.predictBranch(pc, direction);
 
-        void reset() { m_val = m_init_val; }
-        UINT8 getVal() { return m_val; }
+    if (ts->ittage)
+        ts->ittage->pushHistory(direction);
 
-        bool isTaken() { return (m_val > (1 << m_wid)/2 - 1); }
+    if (profileBranches)
+        ts->profile.count(pc, predicted, direction);
 
-        size_t getWidth() {
-            return m_wid;
-        }
-};
+    if (ts->trace)
+        ts->trace->record(pc, direction);
+}
 
-// 移位寄存器 (N < 128)
-class ShiftReg
+// Taken direct branches: the BTB supplies the target
+void predictDirect(THREADID tid, ADDRINT pc, ADDRINT target)
 {
-    size_t m_wid;
-    UINT128 m_val;
-
-    public:
-        ShiftReg(size_t width) : m_wid(width), m_val(0) {}
-
-        bool shiftIn(bool b)
-        {
-            bool ret = !!(m_val & (1 << (m_wid - 1)));
-            m_val <<= 1;
-            m_val |= b;
-            m_val &= (1 << m_wid) - 1;
-            return ret;
-        }
+    ThreadState* ts = (ThreadState*)PIN_GetThreadData(tlsKey, tid);
+    ADDRINT predicted = ts->btb->access(pc, target);
+    ts->btbStats.count(predicted, target);
+}
 
-        UINT128 getVal() { return m_val; }
-};
+// Indirect jumps and calls: the BTB and the indirect target predictor
+void predictIndirect(THREADID tid, ADDRINT pc, ADDRINT target)
+{
+    ThreadState* ts = (ThreadState*)PIN_GetThreadData(tlsKey, tid);
+    ADDRINT predictedBTB = ts->btb->access(pc, target);
+    ADDRINT predictedITTAGE = ts->ittage->access(pc, target);
 
-// Hash functions
-inline UINT128 f_xor(UINT128 a, UINT128 b) { return a ^ b; }
-inline UINT128 f_xor1(UINT128 a, UINT128 b) { return ~a ^ ~b; }
-inline UINT128 f_xnor(UINT128 a, UINT128 b) { return ~(a ^ ~b); }
+    ts->btbStats.count(predictedBTB, target);
+    ts->ittageStats.count(predictedITTAGE, target);
+}
 
+// Calls push their return address
+void pushReturn(THREADID tid, ADDRINT returnAddr)
+{
+    ThreadState* ts = (ThreadState*)PIN_GetThreadData(tlsKey, tid);
+    ts->ras->push(returnAddr);
+}
 
+// Returns: the return address stack supplies the target
+void predictReturn(THREADID tid, ADDRINT target)
+{
+    ThreadState* ts = (ThreadState*)PIN_GetThreadData(tlsKey, tid);
+    ts->rasStats.count(ts->ras->pop(), target);
+}
 
-// Base class of all predictors
-class BranchPredictor
+// Count the instructions of a basic block; true when a sample is due
+ADDRINT PIN_FAST_ANALYSIS_CALL countIns(THREADID tid, UINT32 numIns)
 {
-    public:
-        BranchPredictor() {}
-        virtual ~BranchPredictor() {}
-        virtual bool predict(ADDRINT addr) { return false; };
-        virtual void update(bool takenActually, bool takenPredicted, ADDRINT addr) {};
-};
+    ThreadState* ts = (ThreadState*)PIN_GetThreadData(tlsKey, tid);
+    ts->insCount += numIns;
+    return ts->insCount >= ts->nextSample;
+}
 
-BranchPredictor* BP;
+// Write one CSV row with the accuracy and MPKI of every predictor since
+// the previous sample of the thread
+void sample(ThreadState* ts)
+{
+    UINT64 instructions = ts->insCount - ts->lastSampleIns;
+    if (instructions == 0)
+        return;
 
+    ostringstream row;
+    row << ts->tid << "," << ts->insCount;
+    for (size_t i = 0; i < ts->bank.size(); i++)
+    {
+        BranchStats now = ts->bank.stats(i);
+        UINT64 total = now.total() - ts->lastSample[i].total();
+        UINT64 missed = now.mispredicted() - ts->lastSample[i].mispredicted();
 
+        row << "," << (total ? 100 * double(total - missed) / total : 100)
+            << "," << 1000 * double(missed) / instructions;
+        ts->lastSample[i] = now;
+    }
+    row << "\n";
 
-/* ===================================================================== */
-/* BHT-based branch predictor                                            */
-/* ===================================================================== */
-class BHTPredictor: public BranchPredictor
-{
-    size_t m_entries_log;
-    SaturatingCnt* m_scnt;              // BHT
-    allocator<SaturatingCnt> m_alloc;
-    
-    public:
-        // Constructor
-        // param:   entry_num_log:  BHT行数的对数
-        //          scnt_width:     饱和计数器的位数, 默认值为2
-        BHTPredictor(size_t entry_num_log, size_t scnt_width = 2)
-        {
-            m_entries_log = entry_num_log;
+    ts->lastSampleIns = ts->insCount;
+    while (ts->nextSample <= ts->insCount)
+        ts->nextSample += sampleInterval;
 
-            m_scnt = m_alloc.allocate(1 << entry_num_log);      // Allocate memory for BHT
-            for (int i = 0; i < (1 << entry_num_log); i++)
-                m_alloc.construct(m_scnt + i, scnt_width);      // Call constructor of SaturatingCnt
-        }
+    // Only taken once per interval
+    PIN_GetLock(&sampleLock, ts->tid + 1);
+    SampleFile << row.str();
+    PIN_ReleaseLock(&sampleLock);
+}
 
-        // Destructor
-        ~BHTPredictor()
-        {
-            for (int i = 0; i < (1 << m_entries_log); i++)
-                m_alloc.destroy(m_scnt + i);
+void writeSample(THREADID tid)
+{
+    sample((ThreadState*)PIN_GetThreadData(tlsKey, tid));
+}
 
-            m_alloc.deallocate(m_scnt, 1 << m_entries_log);
-        }
+// Pin calls this function every time a new trace is encountered
+void Trace(TRACE trace, void * v)
+{
+    if (!ROI_Active())
+        return;
 
-        BOOL predict(ADDRINT addr)
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        if (sampleInterval)
         {
-            return m_scnt[truncate(addr, m_entries_log)].isTaken();
+            BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)countIns, IARG_FAST_ANALYSIS_CALL,
+                            IARG_THREAD_ID, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+            BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)writeSample, IARG_THREAD_ID, IARG_END);
         }
-
-        void update(BOOL takenActually, BOOL takenPredicted, ADDRINT addr)
+        else
         {
-        	UINT64 tag = truncate(addr, m_entries_log);
-
-            if (m_scnt[tag].getWidth() == 2) {
-                if (takenActually) {
-                    if (m_scnt[tag].getVal() == 1) {
-                        m_scnt[tag].increase();
-                    }
-
-                    m_scnt[tag].increase();
-                } else {
-                    if (m_scnt[tag].getVal() == 2) {
-                        m_scnt[tag].decrease();
-                    }
-
-                    m_scnt[tag].decrease();
-                }
-            } else if (m_scnt[tag].getWidth() == 3) {
-                switch(m_scnt[tag].getVal()) {
-                    case 0b000: {
-                        if (takenActually) {
-                            m_scnt[tag].increase();
-                        }
-
-                        break;
-                    }
-                    case 0b011: {
-                        if (takenActually) {
-                            m_scnt[tag].reset();
-                            m_scnt[tag].increase();
-                            m_scnt[tag].increase();
-                        } else {
-                            m_scnt[tag].decrease();
-                        }
-
-                        break;
-                    }
-                    case 0b111: {
-                        if (!takenActually) {
-                            m_scnt[tag].decrease();
-                        }
-
-                        break;
-                    }
-                    case 0b100: {
-                        if (!takenActually) {
-                            m_scnt[tag].decrease();
-                            m_scnt[tag].decrease();
-                            m_scnt[tag].decrease();
-                            m_scnt[tag].decrease();
-                        } else {
-                            m_scnt[tag].increase();
-                        }
-
-                        break;
-                    }
-                    default: {
-                        if (takenActually) {
-                            m_scnt[tag].increase();
-                        } else {
-                            m_scnt[tag].decrease();
-                        }
-
-                        break;
-                    }
-                }
-            }
+            BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)countIns, IARG_FAST_ANALYSIS_CALL,
+                            IARG_THREAD_ID, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
         }
-};
+    }
+}
 
-/* ===================================================================== */
-/* Global-history-based branch predictor                                 */
-/* ===================================================================== */
-template<UINT128 (*hash)(UINT128 addr, UINT128 history)>
-class GlobalHistoryPredictor: public BranchPredictor
+// Pin calls this function every time a new instruction is encountered
+void Instruction(INS ins, void * v)
 {
-    ShiftReg* m_ghr;                   // GHR
-    SaturatingCnt* m_scnt;              // PHT中的分支历史字段
-    size_t m_entries_log;                   // PHT行数的对数
-    allocator<SaturatingCnt> m_alloc;
-    
-    public:
-        // Constructor
-        // param:   ghr_width:      Width of GHR
-        //          entry_num_log:  PHT表行数的对数
-        //          scnt_width:     饱和计数器的位数, 默认值为2
-        GlobalHistoryPredictor(size_t ghr_width, size_t entry_num_log, size_t scnt_width = 2)
-        {
-            m_entries_log = entry_num_log;
-            m_ghr = new ShiftReg(ghr_width);
-            m_scnt = m_alloc.allocate(1 << entry_num_log);
-            
-            for (int i = 0; i < (1 << entry_num_log); i++) {
-            	m_alloc.construct(m_scnt + i, scnt_width);
-            }
-        }
+    if (!ROI_Active())
+        return;
 
-        // Destructor
-        ~GlobalHistoryPredictor()
-        {
-            for (int i = 0; i < (1 << m_entries_log); i++) {
-            	m_alloc.destroy(m_scnt + i);
-            }
-            
-            m_alloc.deallocate(m_scnt, 1 << m_entries_log);
-            delete m_ghr;
-        }
-		
-        // Only for TAGE: return a tag according to the specificed address
-        UINT128 get_tag(ADDRINT addr)
-        {
-            return truncate((*hash)(addr, m_ghr->getVal()), m_entries_log);
-        }
+    if (INS_IsControlFlow(ins) && INS_HasFallThrough(ins))
+    {
+        // Insert a call to the branch target
+        INS_InsertCall(ins, IPOINT_TAKEN_BRANCH, (AFUNPTR)predictBranch,
+                        IARG_THREAD_ID, IARG_INST_PTR, IARG_BOOL, TRUE, IARG_END);
 
-        // Only for TAGE: return GHR's value
-        UINT128 get_ghr()
-        {
-            return m_ghr->getVal();
-        }
+        // Insert a call to the next instruction of a branch
+        INS_InsertCall(ins, IPOINT_AFTER, (AFUNPTR)predictBranch,
+                        IARG_THREAD_ID, IARG_INST_PTR, IARG_BOOL, FALSE, IARG_END);
+    }
 
-        // Only for TAGE: reset a saturating counter to default value (which is weak taken)
-        void reset_ctr(ADDRINT addr)
-        {
-            m_scnt[get_tag(addr)].reset();
-        }
+    if (!predictTargets || !INS_IsControlFlow(ins) || INS_IsSyscall(ins))
+        return;
 
-        bool predict(ADDRINT addr)
-        {
-            return m_scnt[truncate((*hash)(addr, m_ghr->getVal()), m_entries_log)].isTaken();
-        }
+    if (INS_IsRet(ins))
+    {
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)predictReturn,
+                        IARG_THREAD_ID, IARG_BRANCH_TARGET_ADDR, IARG_END);
+        return;
+    }
 
-        void update(bool takenActually, bool takenPredicted, ADDRINT addr)
-        {
-        	UINT64 tag = truncate((*hash)(addr, m_ghr->getVal()), m_entries_log);
-
-            if (m_scnt[tag].getWidth() == 2) {
-                if (takenActually) {
-                    if (m_scnt[tag].getVal() == 1) {
-                        m_scnt[tag].increase();
-                    }
-
-                    m_scnt[tag].increase();
-                    m_ghr->shiftIn(true);
-                } else {
-                    if (m_scnt[tag].getVal() == 2) {
-                        m_scnt[tag].decrease();
-                    }
-
-                    m_scnt[tag].decrease();
-                    m_ghr->shiftIn(false);
-                }
-            } else if (m_scnt[tag].getWidth() == 3) {
-                switch(m_scnt[tag].getVal()) {
-                    case 0b000: {
-                        if (takenActually) {
-                            m_scnt[tag].increase();
-
-                            m_ghr->shiftIn(true);
-                        } else {
-                            m_ghr->shiftIn(false);
-                        }
-
-                        break;
-                    }
-                    case 0b011: {
-                        if (takenActually) {
-                            m_scnt[tag].reset();
-                            m_scnt[tag].increase();
-                            m_scnt[tag].increase();
-
-                            m_ghr->shiftIn(true);
-                        } else {
-                            m_scnt[tag].decrease();
-
-                            m_ghr->shiftIn(false);
-                        }
-
-                        break;
-                    }
-                    case 0b111: {
-                        if (!takenActually) {
-                            m_scnt[tag].decrease();
-
-                            m_ghr->shiftIn(false);
-                        } else {
-                            m_ghr->shiftIn(true);
-                        }
-
-                        break;
-                    }
-                    case 0b100: {
-                        if (!takenActually) {
-                            m_scnt[tag].decrease();
-                            m_scnt[tag].decrease();
-                            m_scnt[tag].decrease();
-                            m_scnt[tag].decrease();
-
-                            m_ghr->shiftIn(false);
-                        } else {
-                            m_scnt[tag].increase();
-
-                            m_ghr->shiftIn(true);
-                        }
-
-                        break;
-                    }
-                    default: {
-                        if (takenActually) {
-                            m_scnt[tag].increase();
-
-                            m_ghr->shiftIn(true);
-                        } else {
-                            m_scnt[tag].decrease();
-
-                            m_ghr->shiftIn(false);
-                        }
-
-                        break;
-                    }
-                }
-            }
-        }
-};
+    if (INS_IsCall(ins))
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)pushReturn,
+                        IARG_THREAD_ID, IARG_ADDRINT, INS_NextAddress(ins), IARG_END);
 
-/* ===================================================================== */
-/* Tournament predictor: Select output by global/local selection history */
-/* ===================================================================== */
-class TournamentPredictor: public BranchPredictor
-{
-    BranchPredictor* m_BPs[2];      // Sub-predictors
-    SaturatingCnt* m_gshr;          // Global select-history register
+    if (INS_IsIndirectControlFlow(ins))
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)predictIndirect,
+                        IARG_THREAD_ID, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_END);
+    else if (INS_HasFallThrough(ins))
+        INS_InsertCall(ins, IPOINT_TAKEN_BRANCH, (AFUNPTR)predictDirect,
+                        IARG_THREAD_ID, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_END);
+    else
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)predictDirect,
+                        IARG_THREAD_ID, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_END);
+}
 
-    public:
-        TournamentPredictor(BranchPredictor* BP0, BranchPredictor* BP1, size_t gshr_width = 2)
-        {
-            m_BPs[0] = BP0;
-            m_BPs[1] = BP1;
-            
-            m_gshr = new SaturatingCnt(gshr_width);
-        }
+// This knob sets the output file name
+KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o", "brchPredict.txt", "specify the output file name");
 
-        ~TournamentPredictor()
-        {
-            delete m_gshr;
+// This knob enables the capture of a branch trace for brchReplay
+KNOB<string> KnobTraceFile(KNOB_MODE_WRITEONCE, "pintool", "trace", "", "capture the branch outcomes to a trace file (<file>.<tid> for threads other than 0)");
 
-            delete m_BPs[0];
-            delete m_BPs[1];
-        }
+// This knob makes the threads share the predictors, as the threads of an SMT core do
+KNOB<BOOL> KnobShared(KNOB_MODE_WRITEONCE, "pintool", "shared", "0", "share the predictor tables among threads, each with its own history, instead of one set per thread");
 
-        bool predict(ADDRINT addr)
-        {
-            return m_BPs[!!(m_gshr->getVal() & 2)]->predict(addr);
-        }
-        
-        void update(bool takenActually, bool takenPredicted, ADDRINT addr)
-        {
-        	bool result0 = (m_BPs[0]->predict(addr) == takenActually),
-                 result1 = (m_BPs[1]->predict(addr) == takenActually);
-        	
-        	if (!result0 && result1) {
-                if (m_gshr->getVal() == 1) {
-                    m_gshr->increase();
-                }
-
-                m_gshr->increase();
-            } else if (result0 && !result1) {
-                if (m_gshr->getVal() == 2) {
-                    m_gshr->decrease();
-                }
-
-                m_gshr->decrease();
-            }
-
-            m_BPs[0]->update(takenActually, takenPredicted, addr);
-            m_BPs[1]->update(takenActually, takenPredicted, addr);
-        }
-};
+// This knob adds a predictor configuration to the bank (see newPredictor)
+KNOB<string> KnobPredictors(KNOB_MODE_APPEND, "pintool", "p", "", "add a predictor, e.g. -p bht:12 -p tage:5:10:4:2:12");
 
-/* ===================================================================== */
-/* TArget GEometric history length Predictor                             */
-/* ===================================================================== */
+// These knobs configure the target predictors
+KNOB<BOOL> KnobTargets(KNOB_MODE_WRITEONCE, "pintool", "targets", "0", "model the BTB, the indirect target predictor and the RAS");
+KNOB<UINT32> KnobBTBSetsLog(KNOB_MODE_WRITEONCE, "pintool", "btb_sets", "9", "specify the log2 of the BTB sets");
+KNOB<UINT32> KnobBTBWays(KNOB_MODE_WRITEONCE, "pintool", "btb_ways", "4", "specify the BTB associativity");
+KNOB<UINT32> KnobRASDepth(KNOB_MODE_WRITEONCE, "pintool", "ras", "16", "specify the depth of the return address stack");
+
+// These knobs enable the accuracy/MPKI time series
+KNOB<UINT64> KnobInterval(KNOB_MODE_WRITEONCE, "pintool", "interval", "0", "write accuracy and MPKI every N instructions of a thread (0: no time series)");
+KNOB<string> KnobSampleFile(KNOB_MODE_WRITEONCE, "pintool", "csv", "brchPredict.csv", "specify the time series file name");
+
+// These knobs load and save the predictor state, to start sampled runs warm
+KNOB<string> KnobCheckpointLoad(KNOB_MODE_WRITEONCE, "pintool", "ckpt_load", "", "start the predictors from a checkpoint");
+KNOB<string> KnobCheckpointSave(KNOB_MODE_WRITEONCE, "pintool", "ckpt_save", "", "save the predictors of thread 0 to a checkpoint at exit");
 
-template<UINT128 (*hash1)(UINT128 pc, UINT128 ghr), UINT128 (*hash2)(UINT128 pc, UINT128 ghr)>
-class TAGEPredictor: public BranchPredictor
+// This knob sets the length of the hard branch report
+KNOB<UINT32> KnobTopBranches(KNOB_MODE_WRITEONCE, "pintool", "top", "0", "report the N most mispredicted branches (0: no report)");
+
+// Write the top mispredicted branches with their routine and image
+void writeHardBranches(ostream &out, const string &predictor, const vector<BranchProfile::Entry> &top,
+                       const vector<string> &where)
 {
-    const size_t m_tnum;            // 子预测器个数 (T[0 : m_tnum - 1])
-    const size_t m_entries_log;     // 子预测器T[1 : m_tnum - 1]的PHT行数的对数
-    BranchPredictor** m_T;          // 子预测器指针数组
-    bool* m_T_pred;                 // 用于存储各子预测的预测值
-    UINT8** m_useful;               // usefulness matrix
-    int provider_indx;              // Provider's index of m_T
-    int altpred_indx;               // Alternate provider's index of m_T
-
-    const size_t m_rst_period;      // Reset period of usefulness
-    size_t m_rst_cnt;               // Reset counter
-
-    public:
-        // Constructor
-        // param:   tnum:               The number of sub-predictors
-        //          T0_entry_num_log:   子预测器T0的BHT行数的对数
-        //          T1ghr_len:          子预测器T1的GHR位宽
-        //          alpha:              各子预测器T[1 : m_tnum - 1]的GHR几何倍数关系
-        //          Tn_entry_num_log:   各子预测器T[1 : m_tnum - 1]的PHT行数的对数
-        //          scnt_width:         Width of saturating counter (3 by default)
-        //          rst_period:         Reset period of usefulness
-        TAGEPredictor(size_t tnum, size_t T0_entry_num_log, size_t T1ghr_len, float alpha, size_t Tn_entry_num_log, size_t scnt_width = 2, size_t rst_period = 256*1024)
-        : m_tnum(tnum), m_entries_log(Tn_entry_num_log), m_rst_period(rst_period), m_rst_cnt(0)
-        {
-            m_T = new BranchPredictor* [m_tnum];
-            m_T_pred = new bool [m_tnum];
-            m_useful = new UINT8* [m_tnum];
+    out << "Top " << top.size() << " of " << profile.size() << " branches by mispredictions of "
+        << predictor << ":" << endl;
+    out << setw(18) << "pc" << setw(14) << "executed" << setw(14) << "mispredicted"
+        << setw(9) << "rate" << setw(10) << "bias" << "  location" << endl;
 
-            m_T[0] = new BHTPredictor(T0_entry_num_log);
+    for (size_t i = 0; i < top.size(); i++)
+    {
+        const BranchProfile::Entry &e = top[i];
+        out << "0x" << hex << setfill('0') << setw(16) << e.pc << dec << setfill(' ')
+            << setw(14) << e.executed << setw(14) << e.mispredicted
+            << fixed << setprecision(2)
+            << setw(8) << 100 * double(e.mispredicted) / e.executed << "%"
+            << setw(8) << e.bias() << "% " << (e.taken * 2 >= e.executed ? 'T' : 'N')
+            << "  " << where[i] << endl;
+        out.unsetf(ios::floatfield);
+        out << setprecision(6);
+    }
+}
 
-            size_t ghr_size = T1ghr_len;
-            for (size_t i = 1; i < m_tnum; i++)
-            {
-                m_T[i] = new GlobalHistoryPredictor<hash1>(ghr_size, m_entries_log, scnt_width);
-                ghr_size = (size_t)(ghr_size * alpha);
+// Write the hardware storage of a target predictor as PredictorBank::write() does
+void writeStorage(ostream &out, UINT64 bits)
+{
+    out << "Storage: " << bits << " bits (" << bits / 8192.0 << " KB)" << endl;
+}
 
-                m_useful[i] = new UINT8 [1 << m_entries_log];
-                memset(m_useful[i], 0, sizeof(UINT8)*(1 << m_entries_log));
-            }
-        }
+// This function is called when the application exits
+VOID Fini(int, VOID * v)
+{
+    TargetStats btbStats, ittageStats, rasStats;
+    UINT64 instructions = 0;
+    // The last, partial interval of every thread, before the stats are merged
+    if (sampleInterval)
+    {
+        for (size_t t = 0; t < threadStates.size(); t++)
+            sample(threadStates[t]);
+        SampleFile.close();
+    }
 
-        ~TAGEPredictor()
+    // The stats of the threads add up in the shared bank, or without one in
+    // the bank of the first thread
+    PredictorBank &total = sharedTables || threadStates.empty() ? bank : threadStates[0]->bank;
+    for (size_t t = 0; t < threadStates.size(); t++)
+    {
+        ThreadState* ts = threadStates[t];
+        instructions += ts->insCount;
+        if (&ts->bank != &total)
+            total.merge(ts->bank);
+        profile.merge(ts->profile);
+        btbStats.merge(ts->btbStats);
+        ittageStats.merge(ts->ittageStats);
+        rasStats.merge(ts->rasStats);
+
+        if (ts->trace)
         {
-            for (size_t i = 0; i < m_tnum; i++) delete m_T[i];
-            for (size_t i = 0; i < m_tnum; i++) delete[] m_useful[i];
-
-            delete[] m_T;
-            delete[] m_T_pred;
-            delete[] m_useful;
+            ts->trace->close();
+            cout << "Trace: " << ts->trace->count() << " branches written to " << ts->traceName << endl;
         }
+    }
 
-        bool predict(ADDRINT addr)
-        {
-            provider_indx = 0;
-            m_T_pred[0] = m_T[0]->predict(addr);
+    cout << "Instructions: " << instructions << endl;
+    total.write(cout, instructions);
+
+    // The tables, with the history of the first thread
+    if (!KnobCheckpointSave.Value().empty() && !threadStates.empty())
+    {
+        ofstream out(KnobCheckpointSave.Value().c_str(), ios::binary);
+        if (!threadStates[0]->bank.save(out))
+            cerr << "Cannot write checkpoint " << KnobCheckpointSave.Value() << endl;
+    }
 
-            for (size_t i = 1; i < m_tnum; i++) {
-                GlobalHistoryPredictor<hash1> *T = (GlobalHistoryPredictor<hash1>*)m_T[i];
-                UINT128 tag2 = truncate((*hash2)(addr, T->get_ghr()), m_entries_log);
-                m_T_pred[i] = T->predict(addr);
+    OutFile.setf(ios::showbase);
+    OutFile << "Instructions: " << instructions << endl;
+    total.write(OutFile, instructions);
 
-                if (tag2 == T->get_tag(addr)) {
-                    altpred_indx = provider_indx;
-                    provider_indx = i;
-                }
-            }
+    if (predictTargets)
+    {
+        BTB btb(KnobBTBSetsLog.Value(), KnobBTBWays.Value());
+        ITTAGEPredictor ittage;
+        ReturnStack ras(KnobRASDepth.Value());
 
-            return m_T_pred[provider_indx];
+        ostream* outs[] = { &cout, &OutFile };
+        for (size_t i = 0; i < 2; i++)
+        {
+            *outs[i] << "Target predictor: btb:" << KnobBTBSetsLog.Value() << ":" << KnobBTBWays.Value() << endl;
+            writeStorage(*outs[i], btb.storageBits());
+            btbStats.write(*outs[i]);
+            *outs[i] << "Target predictor: ittage" << endl;
+            writeStorage(*outs[i], ittage.storageBits());
+            ittageStats.write(*outs[i]);
+            *outs[i] << "Target predictor: ras:" << KnobRASDepth.Value() << endl;
+            writeStorage(*outs[i], ras.storageBits());
+            rasStats.write(*outs[i]);
         }
+    }
+
+    if (profileBranches && total.size() > 0)
+    {
+        vector<BranchProfile::Entry> top = profile.top(KnobTopBranches.Value());
 
-        void update(bool takenActually, bool takenPredicted, ADDRINT addr)
+        // Resolve the names now: the images are still loaded at exit
+        vector<string> where;
+        PIN_LockClient();
+        for (size_t i = 0; i < top.size(); i++)
         {
-            m_rst_cnt++;
-            // 更新provider
-            m_T[provider_indx]->update(takenActually, takenPredicted, addr);
-
-            // 更新useful
-            if (provider_indx != 0) {
-                UINT64 tag = ((GlobalHistoryPredictor<hash1>*)m_T[provider_indx])->get_tag(addr);
-
-                if (takenActually) {
-                    if (takenPredicted) {
-                        if (!m_T_pred[altpred_indx]) {
-                            m_useful[provider_indx][tag]++;
-                        }
-                    } else {
-                        if (m_T_pred[altpred_indx]) {
-                            m_useful[provider_indx][tag]--;
-                        }
-                    }
-                } else {
-                    if (takenPredicted) {
-                        if (!m_T_pred[altpred_indx]) {
-                            m_useful[provider_indx][tag]--;
-                        }
-                    } else {
-                        if (m_T_pred[altpred_indx]) {
-                            m_useful[provider_indx][tag]++;
-                        }
-                    }
-                }
-            }
-
-            // 周期性useful清零
-            if (m_rst_cnt == m_rst_period) {
-                for (size_t i = 1; i < m_tnum; i++) {
-                    for (int j = 0; j < (1 << m_entries_log); j++) {
-                        m_useful[i][j] = 0;
-                    }
-                }
-
-                m_rst_cnt = 0;
-            }
-
-            bool updateFlag = false;
-            if ((takenActually && !takenPredicted) || (!takenActually && takenPredicted)) {
-                for (size_t i = provider_indx + 1; i < m_tnum; i++) {
-                    UINT64 tag = truncate((*hash1)(addr, ((GlobalHistoryPredictor<hash1>*)m_T[i])->get_ghr()), m_entries_log);
-                    if (m_useful[i][tag] == 0) {
-                        ((GlobalHistoryPredictor<hash1>*)m_T[i])->reset_ctr(addr);
-                        updateFlag = true;
-
-                        break;
-                    }
-                }
-
-                if (!updateFlag) {
-                    for (size_t i = provider_indx + 1; i < m_tnum; i++) {
-                        UINT64 tag = truncate((*hash1)(addr, ((GlobalHistoryPredictor<hash1>*)m_T[i])->get_ghr()), m_entries_log);
-                        m_useful[i][tag]--;
-                    }
-                }
-            }
+            string rtn = RTN_FindNameByAddress(top[i].pc);
+            IMG img = IMG_FindByAddress(top[i].pc);
+            where.push_back((rtn.empty() ? "?" : rtn) + " (" + (IMG_Valid(img) ? IMG_Name(img) : "?") + ")");
         }
-};
+        PIN_UnlockClient();
 
-// This function is called every time a control-flow instruction is encountered
-void predictBranch(ADDRINT pc, BOOL direction)
+        writeHardBranches(cout, total.name(0), top, where);
+        OutFile.unsetf(ios::showbase);
+        writeHardBranches(OutFile, total.name(0), top, where);
+    }
+    OutFile.close();
+}
+
+// Fill a bank with the predictors under evaluation; false on a bad -p
+bool addPredictors(PredictorBank &b)
 {
-    BOOL prediction = BP->predict(pc);
-    BP->update(direction, prediction, pc);
-    if (prediction)
+    for (UINT32 i = 0; i < KnobPredictors.NumberOfValues(); i++)
     {
-        if (direction)
-            takenCorrect++;
-        else
-            takenIncorrect++;
+        if (!KnobPredictors.Value(i).empty() && !b.add(KnobPredictors.Value(i)))
+        {
+            cerr << "Unknown or invalid predictor " << KnobPredictors.Value(i) << endl;
+            return false;
+        }
+    }
+
+    // Predictors are selected with configuration strings, e.g.
+    //     -p bht:12 -p gshare:16:16 -p tournament:16:16:16 -p tage:5:10:4:2:12
+    // A new model only needs a case in newPredictor() (brchPredict.h); use
+    // brchSweep to pick its best configuration under a storage budget.
+    if (b.size() == 0)
+        b.add("bht:12");
+
+    return true;
+}
+
+VOID ThreadStart(THREADID tid, CONTEXT* ctxt, INT32 flags, VOID* v)
+{
+    ThreadState* ts = new ThreadState();
+    ts->tid = tid;
+
+    if (sharedTables)
+    {
+        ts->bank.share(bank);
     }
     else
     {
-        if (direction)
-            notTakenIncorrect++;
-        else
-            notTakenCorrect++;
+        addPredictors(ts->bank);
+        if (!warmState.empty())
+        {
+            istringstream in(warmState);
+            ts->bank.load(in);
+        }
     }
-}
 
-// Pin calls this function every time a new instruction is encountered
-void Instruction(INS ins, void * v)
-{
-    if (INS_IsControlFlow(ins) && INS_HasFallThrough(ins))
+    ts->trace = NULL;
+    if (captureTrace)
     {
-        // Insert a call to the branch target
-        INS_InsertCall(ins, IPOINT_TAKEN_BRANCH, (AFUNPTR)predictBranch,
-                        IARG_INST_PTR, IARG_BOOL, TRUE, IARG_END);
+        ostringstream name;
+        name << KnobTraceFile.Value();
+        if (tid != 0)
+            name << "." << tid;
+        ts->traceName = name.str();
+
+        ts->trace = new BranchTraceWriter();
+        if (!ts->trace->open(ts->traceName.c_str()))
+        {
+            cerr << "Cannot open trace file " << ts->traceName << endl;
+            delete ts->trace;
+            ts->trace = NULL;
+        }
+    }
 
-        // Insert a call to the next instruction of a branch
-        INS_InsertCall(ins, IPOINT_AFTER, (AFUNPTR)predictBranch,
-                        IARG_INST_PTR, IARG_BOOL, FALSE, IARG_END);
+    ts->btb = NULL;
+    ts->ittage = NULL;
+    ts->ras = NULL;
+    if (predictTargets)
+    {
+        ts->btb = sharedTables ? sharedBTB : new BTB(KnobBTBSetsLog.Value(), KnobBTBWays.Value());
+        ts->ittage = sharedTables ? new ITTAGEPredictor(*sharedITTAGE, SHARE_TABLES) : new ITTAGEPredictor();
+        ts->ras = new ReturnStack(KnobRASDepth.Value());
     }
-}
 
-// This knob sets the output file name
-KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o", "brchPredict.txt", "specify the output file name");
+    ts->insCount = 0;
+    ts->nextSample = sampleInterval ? sampleInterval : ~0ULL;
+    ts->lastSampleIns = 0;
+    ts->lastSample.assign(ts->bank.size(), BranchStats());
 
-// This function is called when the application exits
-VOID Fini(int, VOID * v)
-{
-	double precision = 100 * double(takenCorrect + notTakenCorrect) / (takenCorrect + notTakenCorrect + takenIncorrect + notTakenIncorrect);
-    
-    cout << "takenCorrect: " << takenCorrect << endl
-    	<< "takenIncorrect: " << takenIncorrect << endl
-    	<< "notTakenCorrect: " << notTakenCorrect << endl
-    	<< "nnotTakenIncorrect: " << notTakenIncorrect << endl
-    	<< "Precision: " << precision << endl;
-    
-    OutFile.setf(ios::showbase);
-    OutFile << "takenCorrect: " << takenCorrect << endl
-    	<< "takenIncorrect: " << takenIncorrect << endl
-    	<< "notTakenCorrect: " << notTakenCorrect << endl
-    	<< "nnotTakenIncorrect: " << notTakenIncorrect << endl
-    	<< "Precision: " << precision << endl;
-    
-    OutFile.close();
-    delete BP;
+    PIN_SetThreadData(tlsKey, ts, tid);
+
+    PIN_GetLock(&threadsLock, tid + 1);
+    threadStates.push_back(ts);
+    PIN_ReleaseLock(&threadsLock);
 }
 
 /* ===================================================================== */
@@ -632,17 +480,73 @@ INT32 Usage()
 
 int main(int argc, char * argv[])
 {
-    // TODO: New your Predictor below.
-    // BP = new BHTPredictor(12);
-    // BP = new GlobalHistoryPredictor<f_xor>(16, 16);
-    // BP = new TournamentPredictor(new BHTPredictor(16), new GlobalHistoryPredictor<f_xor>(16, 16));
-    // BP = new TAGEPredictor<f_xor, f_xor1>(5, 10, 4, 2, 12);
-
     // Initialize pin
     if (PIN_Init(argc, argv)) return Usage();
-    
+    ROI_Init();
+
+    sharedTables = KnobShared.Value();
+
+    // Check the configurations; only shared tables are kept, private ones
+    // are built by every thread
+    PredictorBank* configs = sharedTables ? &bank : new PredictorBank();
+    if (!addPredictors(*configs))
+        return Usage();
+
+    if (!KnobCheckpointLoad.Value().empty())
+    {
+        ifstream in(KnobCheckpointLoad.Value().c_str(), ios::binary);
+        ostringstream content;
+        content << in.rdbuf();
+        warmState = content.str();
+
+        // Check it once; private banks reload it for every thread
+        istringstream check(warmState);
+        int restored = configs->load(check);
+        if (restored < 0)
+        {
+            cerr << "Cannot read checkpoint " << KnobCheckpointLoad.Value() << endl;
+            return Usage();
+        }
+        cout << "Checkpoint: " << restored << " of " << configs->size() << " predictors restored" << endl;
+    }
+
     OutFile.open(KnobOutputFile.Value().c_str());
 
+    // Routine names for the hard branch report
+    profileBranches = KnobTopBranches.Value() > 0;
+    if (profileBranches)
+        PIN_InitSymbols();
+
+    captureTrace = !KnobTraceFile.Value().empty();
+
+    predictTargets = KnobTargets.Value();
+    if (predictTargets && sharedTables)
+    {
+        sharedBTB = new BTB(KnobBTBSetsLog.Value(), KnobBTBWays.Value());
+        sharedITTAGE = new ITTAGEPredictor();
+    }
+
+    tlsKey = PIN_CreateThreadDataKey(NULL);
+    PIN_InitLock(&threadsLock);
+    PIN_AddThreadStartFunction(ThreadStart, 0);
+
+    sampleInterval = KnobInterval.Value();
+    if (sampleInterval)
+    {
+        SampleFile.open(KnobSampleFile.Value().c_str());
+        SampleFile << "tid,instructions";
+        for (size_t i = 0; i < configs->size(); i++)
+            SampleFile << "," << configs->name(i) << " accuracy," << configs->name(i) << " mpki";
+        SampleFile << endl;
+        PIN_InitLock(&sampleLock);
+    }
+
+    if (!sharedTables)
+        delete configs;
+
+    // Register Trace to be called to count the instructions
+    TRACE_AddInstrumentFunction(Trace, 0);
+
     // Register Instruction to be called to instrument instructions
     INS_AddInstrumentFunction(Instruction, 0);
 
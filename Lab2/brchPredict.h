@@ -0,0 +1,2273 @@
+// Branch predictor models: saturating counters, shift registers and the
+// BHT, global-history, tournament, TAGE and perceptron predictors built
+// from them, plus the loop predictor and statistical corrector that can be
+// stacked on them.
+// The predictors have a fused lookup/train path (see FusedPredictor) and
+// can be composed at compile time, e.g. Tournament<BHTPredictor, ...>.
+// With BP_STANDALONE defined the header does not need Pin, so that the
+// offline replay (brchReplay.cpp) can be built as a plain executable.
+#ifndef BRCH_PREDICT_H
+#define BRCH_PREDICT_H
+
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <istream>
+#include <sstream>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#ifdef BP_STANDALONE
+#include <stdint.h>
+typedef uint64_t ADDRINT;
+typedef bool BOOL;
+#else
+#include "pin.H"
+#endif
+
+typedef signed char         INT8;
+typedef unsigned char       UINT8;
+typedef unsigned short      UINT16;
+typedef unsigned int        UINT32;
+typedef unsigned long int   UINT64;
+typedef unsigned __int128   UINT128;
+
+// 将val截断, 使其宽度变成bits
+#define truncate(val, bits) ((val) & (((UINT128)1 << (bits)) - 1))
+
+// Saves the raw state of predictors to a stream or restores it from one.
+// Each model has one checkpoint() method that serves both directions, so
+// the saved layout and the restored one cannot drift apart. The state is
+// written in host byte order: checkpoints are not portable across hosts.
+class Checkpoint
+{
+    std::ostream* m_out;
+    std::istream* m_in;
+
+    public:
+        explicit Checkpoint(std::ostream &out) : m_out(&out), m_in(NULL) {}
+        explicit Checkpoint(std::istream &in) : m_out(NULL), m_in(&in) {}
+
+        void bytes(void* p, size_t n)
+        {
+            if (m_out)
+                m_out->write((const char*)p, n);
+            else
+                m_in->read((char*)p, n);
+        }
+
+        template<class T>
+        void value(T &v) { bytes(&v, sizeof(T)); }
+
+        bool good() const { return m_out ? m_out->good() : m_in->good(); }
+};
+
+// 饱和计数器 (N < 64)
+class SaturatingCnt
+{
+    size_t m_wid;
+    UINT8 m_val;
+    const UINT8 m_init_val;
+
+    public:
+        SaturatingCnt(size_t width = 2) : m_init_val((1 << width) / 2)
+        {
+            m_wid = width;
+            m_val = m_init_val;
+        }
+
+        void increase() { if (m_val < (1 << m_wid) - 1) m_val++; }
+        void decrease() { if (m_val > 0) m_val--; }
+
+        void reset() { m_val = m_init_val; }
+        UINT8 getVal() { return m_val; }
+
+        bool isTaken() { return (m_val > (1 << m_wid)/2 - 1); }
+
+        size_t getWidth() {
+            return m_wid;
+        }
+
+        void checkpoint(Checkpoint &cp) { cp.value(m_val); }
+
+        UINT64 storageBits() const { return m_wid; }
+};
+
+// The newest orig_len outcomes of a global history XOR-folded into comp_len
+// bits (a circular shift register as in the TAGE papers). With
+// orig_len <= comp_len it is exactly the last orig_len outcomes.
+// comp_len must be in [1, 63]; newPredictor() checks the configurations.
+class FoldedHistory
+{
+    UINT64 m_comp;
+    UINT64 m_comp_mask;
+    size_t m_orig_len;
+    size_t m_comp_len;
+    size_t m_outpoint;                  // Position of the outcome leaving the window
+
+    public:
+        FoldedHistory(size_t orig_len, size_t comp_len)
+            : m_comp(0), m_comp_mask((1ULL << comp_len) - 1), m_orig_len(orig_len), m_comp_len(comp_len),
+              m_outpoint(orig_len % comp_len) {}
+
+        // Shift in the newest outcome; out is the one leaving the window
+        void update(bool in, bool out)
+        {
+            UINT64 comp = (m_comp << 1) | in;
+            comp ^= (UINT64)out << m_outpoint;
+            m_comp = (comp ^ (comp >> m_comp_len)) & m_comp_mask;
+        }
+
+        // Invert the newest outcome, which update() put in bit 0
+        void flipNewest() { m_comp ^= 1; }
+
+        UINT64 getVal() const { return m_comp; }
+        size_t length() const { return m_orig_len; }
+
+        void checkpoint(Checkpoint &cp) { cp.value(m_comp); }
+
+        UINT64 storageBits() const { return m_comp_len; }
+};
+
+// Global branch history of arbitrary length, kept in a circular buffer.
+// Folded views of it are registered once and kept side by side; every push
+// updates each in O(1), so a hash over any history length costs O(1).
+class GlobalHistory
+{
+    std::vector<UINT8> m_bits;          // One outcome per byte, newest at m_head
+    size_t m_mask;
+    size_t m_head;
+    std::vector<FoldedHistory> m_folds;
+
+    public:
+        // max_len: longest history any folded view covers
+        GlobalHistory(size_t max_len) : m_head(0)
+        {
+            size_t size = 1;
+            while (size <= max_len)
+                size <<= 1;
+
+            m_bits.assign(size, 0);
+            m_mask = size - 1;
+        }
+
+        // The i-th most recent outcome (0: newest), i <= max_len
+        bool operator[](size_t i) const { return m_bits[(m_head + i) & m_mask]; }
+
+        // Register a view of the newest orig_len outcomes folded into
+        // comp_len (< 64) bits; returns its handle for folded()
+        size_t fold(size_t orig_len, size_t comp_len)
+        {
+            m_folds.push_back(FoldedHistory(orig_len, comp_len));
+            return m_folds.size() - 1;
+        }
+
+        UINT64 folded(size_t handle) const { return m_folds[handle].getVal(); }
+
+        void push(bool taken)
+        {
+            m_head = (m_head - 1) & m_mask;
+            m_bits[m_head] = taken;
+
+            for (FoldedHistory *f = &m_folds[0], *end = f + m_folds.size(); f != end; f++)
+                f->update(taken, m_bits[(m_head + f->length()) & m_mask]);
+        }
+
+        // Replace the newest outcome, e.g. a speculative one found wrong.
+        // It sits in bit 0 of every folded view, so each flips in O(1).
+        void repair(bool taken)
+        {
+            if (m_bits[m_head] == taken)
+                return;
+
+            m_bits[m_head] = taken;
+            for (size_t i = 0; i < m_folds.size(); i++)
+                m_folds[i].flipNewest();
+        }
+
+        size_t capacity() const { return m_mask; }
+
+        void checkpoint(Checkpoint &cp)
+        {
+            cp.bytes(&m_bits[0], m_bits.size());
+            cp.value(m_head);
+            for (size_t i = 0; i < m_folds.size(); i++)
+                m_folds[i].checkpoint(cp);
+        }
+
+        // The longest history any view covers, plus the folded registers
+        UINT64 storageBits() const
+        {
+            UINT64 longest = 0, bits = 0;
+            for (size_t i = 0; i < m_folds.size(); i++)
+            {
+                longest = std::max<UINT64>(longest, m_folds[i].length());
+                bits += m_folds[i].storageBits();
+            }
+            return longest + bits;
+        }
+};
+
+// Bits of a counter running up to n - 1
+inline UINT64 counterBits(UINT64 n)
+{
+    UINT64 bits = 0;
+    while (((UINT64)1 << bits) < n)
+        bits++;
+    return bits;
+}
+
+// Hash functions
+inline UINT128 f_xor(UINT128 a, UINT128 b) { return a ^ b; }
+inline UINT128 f_xor1(UINT128 a, UINT128 b) { return ~a ^ ~b; }
+inline UINT128 f_xnor(UINT128 a, UINT128 b) { return ~(a ^ ~b); }
+
+
+
+// Tag of the constructors that build a predictor over the tables of
+// another one (see BranchPredictor::shareTables())
+enum ShareTables { SHARE_TABLES };
+
+// Base class of all predictors
+class BranchPredictor
+{
+    public:
+        BranchPredictor() {}
+        virtual ~BranchPredictor() {}
+        virtual bool predict(ADDRINT addr) { return false; };
+        virtual void update(bool takenActually, bool takenPredicted, ADDRINT addr) {};
+
+        // Predict the branch at addr, train with its outcome and return the
+        // prediction: one virtual call per branch on the simulation hot path
+        virtual bool access(ADDRINT addr, bool takenActually)
+        {
+            bool takenPredicted = predict(addr);
+            update(takenActually, takenPredicted, addr);
+            return takenPredicted;
+        }
+
+        // Save or restore the tables and the history
+        virtual void checkpoint(Checkpoint &cp) {}
+
+        // Hardware storage: every counter, tag, useful bit and history bit
+        virtual UINT64 storageBits() const { return 0; }
+
+        // A predictor of the same configuration over the tables of this one,
+        // with a copy of the history of its own, as another hardware thread
+        // of an SMT core sees it. The two update the tables racily, without
+        // a lock; this one keeps the tables and must outlive the new one.
+        // Every predictor newPredictor() builds supports it; NULL otherwise.
+        virtual BranchPredictor* shareTables() { return NULL; }
+};
+
+// Base of the predictors with a fused lookup/train path.
+// P provides
+//     bool lookup(ADDRINT addr, Ctx &ctx);                 // predict, keep indices in ctx
+//     void train(const Ctx &ctx, bool takenActually);      // update the entries in ctx
+// as non-virtual members, so that predictors composed from them at compile
+// time hash every table once per branch and pay no virtual dispatch inside.
+// predict()/update() remain for callers that use the two-call protocol;
+// update() trains the entries found by the last predict().
+// Predictors that can be updated late (see DelayedUpdate) split train() into
+//     void retire(const Ctx &ctx, bool takenActually);     // update the tables
+//     void speculate(bool taken);                          // push into the history
+//     void repair(bool taken);                             // fix the newest history bit
+template<class P, class Ctx>
+class FusedPredictor: public BranchPredictor
+{
+    Ctx m_ctx;                          // Context of the last predict()
+
+    public:
+        bool predict(ADDRINT addr)
+        {
+            return static_cast<P*>(this)->lookup(addr, m_ctx);
+        }
+
+        void update(bool takenActually, bool takenPredicted, ADDRINT addr)
+        {
+            static_cast<P*>(this)->train(m_ctx, takenActually);
+        }
+
+        bool access(ADDRINT addr, bool takenActually)
+        {
+            Ctx ctx;
+            bool takenPredicted = static_cast<P*>(this)->lookup(addr, ctx);
+            static_cast<P*>(this)->train(ctx, takenActually);
+            return takenPredicted;
+        }
+
+        BranchPredictor* shareTables() { return new P(*static_cast<P*>(this), SHARE_TABLES); }
+};
+
+// 按实验要求的状态机更新饱和计数器:
+// 2位计数器在弱状态预测错误时直接跳到另一方向的强状态,
+// 3位计数器在011/100处跳变; 其他位宽为普通饱和计数
+inline void trainCounter(SaturatingCnt &cnt, bool takenActually)
+{
+    if (cnt.getWidth() == 2) {
+        if (takenActually) {
+            if (cnt.getVal() == 1) {
+                cnt.increase();
+            }
+
+            cnt.increase();
+        } else {
+            if (cnt.getVal() == 2) {
+                cnt.decrease();
+            }
+
+            cnt.decrease();
+        }
+    } else if (cnt.getWidth() == 3) {
+        switch(cnt.getVal()) {
+            case 0b000: {
+                if (takenActually) {
+                    cnt.increase();
+                }
+
+                break;
+            }
+            case 0b011: {
+                if (takenActually) {
+                    cnt.reset();
+                    cnt.increase();
+                    cnt.increase();
+                } else {
+                    cnt.decrease();
+                }
+
+                break;
+            }
+            case 0b111: {
+                if (!takenActually) {
+                    cnt.decrease();
+                }
+
+                break;
+            }
+            case 0b100: {
+                if (!takenActually) {
+                    cnt.decrease();
+                    cnt.decrease();
+                    cnt.decrease();
+                    cnt.decrease();
+                } else {
+                    cnt.increase();
+                }
+
+                break;
+            }
+            default: {
+                if (takenActually) {
+                    cnt.increase();
+                } else {
+                    cnt.decrease();
+                }
+
+                break;
+            }
+        }
+    } else {
+        if (takenActually) {
+            cnt.increase();
+        } else {
+            cnt.decrease();
+        }
+    }
+}
+
+// Array of W-bit saturating counters (2 <= W <= 4) packed into 64-bit words,
+// 64 / W counters per word, so a table takes its real storage budget.
+// train() follows trainCounter() through a transition table built from it.
+template<size_t W>
+class PackedCounters
+{
+    static const size_t PER_WORD = 64 / W;
+    static const UINT64 MASK = (1ULL << W) - 1;
+
+    UINT64* m_words;
+    bool m_own;                         // Whether m_words is ours or another table's
+    size_t m_num;
+    UINT8 m_init_val;
+    UINT64 m_init_word;                 // Word with every counter at m_init_val
+    UINT8 m_next[2][1 << W];            // m_next[taken][val]: value after training
+
+    public:
+        // init_val defaults to weakly taken
+        PackedCounters(size_t num, UINT8 init_val = 1 << (W - 1)) : m_own(true), m_num(num), m_init_val(init_val)
+        {
+            m_words = new UINT64[(num + PER_WORD - 1) / PER_WORD];
+
+            m_init_word = 0;
+            for (size_t k = 0; k < PER_WORD; k++)
+                m_init_word |= (UINT64)init_val << (k * W);
+
+            for (UINT8 v = 0; v <= MASK; v++) {
+                for (int taken = 0; taken < 2; taken++) {
+                    SaturatingCnt cnt(W);
+                    while (cnt.getVal() > 0)
+                        cnt.decrease();
+                    while (cnt.getVal() < v)
+                        cnt.increase();
+
+                    trainCounter(cnt, taken);
+                    m_next[taken][v] = cnt.getVal();
+                }
+            }
+
+            resetAll();
+        }
+
+        // The counters of other
+        PackedCounters(PackedCounters &other, ShareTables)
+            : m_words(other.m_words), m_own(false), m_num(other.m_num), m_init_val(other.m_init_val),
+              m_init_word(other.m_init_word)
+        {
+            memcpy(m_next, other.m_next, sizeof(m_next));
+        }
+
+        ~PackedCounters()
+        {
+            if (m_own)
+                delete[] m_words;
+        }
+
+        UINT8 get(UINT64 i) const
+        {
+            return (m_words[i / PER_WORD] >> (i % PER_WORD * W)) & MASK;
+        }
+
+        void set(UINT64 i, UINT8 val)
+        {
+            UINT64 &word = m_words[i / PER_WORD];
+            size_t shift = i % PER_WORD * W;
+            word = (word & ~(MASK << shift)) | ((UINT64)val << shift);
+        }
+
+        bool isTaken(UINT64 i) const { return get(i) >> (W - 1); }
+
+        void train(UINT64 i, bool takenActually) { set(i, m_next[takenActually][get(i)]); }
+
+        void increase(UINT64 i) { UINT8 v = get(i); if (v < MASK) set(i, v + 1); }
+        void decrease(UINT64 i) { UINT8 v = get(i); if (v > 0) set(i, v - 1); }
+
+        void reset(UINT64 i) { set(i, m_init_val); }
+
+        // Reset every counter, a word at a time
+        void resetAll()
+        {
+            for (size_t w = 0; w < (m_num + PER_WORD - 1) / PER_WORD; w++)
+                m_words[w] = m_init_word;
+        }
+
+        // Halve every counter, a word at a time
+        void age()
+        {
+            UINT64 low = 0;             // The low W - 1 bits of every counter
+            for (size_t k = 0; k < PER_WORD; k++)
+                low |= (MASK >> 1) << (k * W);
+
+            for (size_t w = 0; w < (m_num + PER_WORD - 1) / PER_WORD; w++)
+                m_words[w] = (m_words[w] >> 1) & low;
+        }
+
+        size_t size() const { return m_num; }
+        size_t bytes() const { return (m_num + PER_WORD - 1) / PER_WORD * sizeof(UINT64); }
+
+        void checkpoint(Checkpoint &cp) { cp.bytes(m_words, bytes()); }
+
+        // W bits per counter; the padding of the last word is not storage
+        UINT64 storageBits() const { return (UINT64)m_num * W; }
+};
+
+// Counter table whose width is chosen at run time: the front end of
+// PackedCounters<2..4>. A table never changes width, so the switch is always
+// predicted correctly. Widths below 2 use 2 bits, widths above 4 use 4 bits.
+class CounterTable
+{
+    size_t m_wid;
+    PackedCounters<2>* m_c2;
+    PackedCounters<3>* m_c3;
+    PackedCounters<4>* m_c4;
+
+    public:
+        CounterTable(size_t num, size_t width) : m_c2(NULL), m_c3(NULL), m_c4(NULL)
+        {
+            m_wid = width < 2 ? 2 : width > 4 ? 4 : width;
+            if (m_wid == 2)
+                m_c2 = new PackedCounters<2>(num);
+            else if (m_wid == 3)
+                m_c3 = new PackedCounters<3>(num);
+            else
+                m_c4 = new PackedCounters<4>(num);
+        }
+
+        CounterTable(CounterTable &other, ShareTables) : m_wid(other.m_wid), m_c2(NULL), m_c3(NULL), m_c4(NULL)
+        {
+            if (other.m_c2)
+                m_c2 = new PackedCounters<2>(*other.m_c2, SHARE_TABLES);
+            if (other.m_c3)
+                m_c3 = new PackedCounters<3>(*other.m_c3, SHARE_TABLES);
+            if (other.m_c4)
+                m_c4 = new PackedCounters<4>(*other.m_c4, SHARE_TABLES);
+        }
+
+        ~CounterTable()
+        {
+            delete m_c2;
+            delete m_c3;
+            delete m_c4;
+        }
+
+        bool isTaken(UINT64 i) const
+        {
+            switch (m_wid) {
+                case 2: return m_c2->isTaken(i);
+                case 3: return m_c3->isTaken(i);
+                default: return m_c4->isTaken(i);
+            }
+        }
+
+        void train(UINT64 i, bool takenActually)
+        {
+            switch (m_wid) {
+                case 2: m_c2->train(i, takenActually); break;
+                case 3: m_c3->train(i, takenActually); break;
+                default: m_c4->train(i, takenActually); break;
+            }
+        }
+
+        void reset(UINT64 i)
+        {
+            switch (m_wid) {
+                case 2: m_c2->reset(i); break;
+                case 3: m_c3->reset(i); break;
+                default: m_c4->reset(i); break;
+            }
+        }
+
+        void resetAll()
+        {
+            switch (m_wid) {
+                case 2: m_c2->resetAll(); break;
+                case 3: m_c3->resetAll(); break;
+                default: m_c4->resetAll(); break;
+            }
+        }
+
+        size_t width() const { return m_wid; }
+
+        size_t bytes() const
+        {
+            switch (m_wid) {
+                case 2: return m_c2->bytes();
+                case 3: return m_c3->bytes();
+                default: return m_c4->bytes();
+            }
+        }
+
+        void checkpoint(Checkpoint &cp)
+        {
+            switch (m_wid) {
+                case 2: m_c2->checkpoint(cp); break;
+                case 3: m_c3->checkpoint(cp); break;
+                default: m_c4->checkpoint(cp); break;
+            }
+        }
+
+        UINT64 storageBits() const
+        {
+            switch (m_wid) {
+                case 2: return m_c2->storageBits();
+                case 3: return m_c3->storageBits();
+                default: return m_c4->storageBits();
+            }
+        }
+};
+
+// Context of a single-table lookup
+struct TableCtx
+{
+    UINT64 idx;                         // Index of the counter used
+    bool pred;                          // Its prediction
+};
+
+/* ===================================================================== */
+/* BHT-based branch predictor                                            */
+/* ===================================================================== */
+class BHTPredictor: public FusedPredictor<BHTPredictor, TableCtx>
+{
+    size_t m_entries_log;
+    CounterTable m_scnt;                // BHT
+    
+    public:
+        typedef TableCtx Ctx;
+
+        // Constructor
+        // param:   entry_num_log:  BHT行数的对数
+        //          scnt_width:     饱和计数器的位数, 默认值为2
+        BHTPredictor(size_t entry_num_log, size_t scnt_width = 2)
+            : m_entries_log(entry_num_log), m_scnt(1 << entry_num_log, scnt_width) {}
+
+        BHTPredictor(BHTPredictor &other, ShareTables)
+            : m_entries_log(other.m_entries_log), m_scnt(other.m_scnt, SHARE_TABLES) {}
+
+        bool lookup(ADDRINT addr, Ctx &ctx)
+        {
+            ctx.idx = truncate(addr, m_entries_log);
+            return ctx.pred = m_scnt.isTaken(ctx.idx);
+        }
+
+        void train(const Ctx &ctx, bool takenActually)
+        {
+            m_scnt.train(ctx.idx, takenActually);
+        }
+
+        // No history: retiring is all of training
+        void retire(const Ctx &ctx, bool takenActually) { train(ctx, takenActually); }
+        void speculate(bool taken) {}
+        void repair(bool taken) {}
+
+        void checkpoint(Checkpoint &cp) { m_scnt.checkpoint(cp); }
+
+        UINT64 storageBits() const { return m_scnt.storageBits(); }
+};
+
+/* ===================================================================== */
+/* Global-history-based branch predictor                                 */
+/* ===================================================================== */
+template<UINT128 (*hash)(UINT128 addr, UINT128 history)>
+class GlobalHistoryPredictor: public FusedPredictor<GlobalHistoryPredictor<hash>, TableCtx>
+{
+    GlobalHistory* m_hist;              // GHR
+    bool m_own_hist;                    // Whether train() pushes the outcomes into m_hist
+    size_t m_fold;                      // GHR folded to the index width
+    size_t m_entries_log;                   // PHT行数的对数
+    CounterTable m_scnt;                // PHT中的分支历史字段
+    
+    public:
+        typedef TableCtx Ctx;
+
+        // Constructor
+        // param:   ghr_width:      Width of GHR (any length; folded to entry_num_log bits)
+        //          entry_num_log:  PHT表行数的对数
+        //          scnt_width:     饱和计数器的位数, 默认值为2
+        GlobalHistoryPredictor(size_t ghr_width, size_t entry_num_log, size_t scnt_width = 2)
+            : m_hist(new GlobalHistory(ghr_width)), m_own_hist(true), m_fold(m_hist->fold(ghr_width, entry_num_log)),
+              m_entries_log(entry_num_log), m_scnt(1 << entry_num_log, scnt_width) {}
+
+        // Constructor over a history shared with other tables; its owner
+        // pushes the outcomes
+        GlobalHistoryPredictor(GlobalHistory* hist, size_t ghr_width, size_t entry_num_log, size_t scnt_width = 2)
+            : m_hist(hist), m_own_hist(false), m_fold(m_hist->fold(ghr_width, entry_num_log)),
+              m_entries_log(entry_num_log), m_scnt(1 << entry_num_log, scnt_width) {}
+
+        // The PHT of other, with a copy of its history, or with hist (which
+        // has the folding of other's) if the owner of hist pushes it
+        GlobalHistoryPredictor(GlobalHistoryPredictor &other, ShareTables, GlobalHistory* hist = NULL)
+            : m_hist(hist ? hist : new GlobalHistory(*other.m_hist)), m_own_hist(!hist), m_fold(other.m_fold),
+              m_entries_log(other.m_entries_log), m_scnt(other.m_scnt, SHARE_TABLES) {}
+
+        // Destructor
+        ~GlobalHistoryPredictor()
+        {
+            if (m_own_hist)
+                delete m_hist;
+        }
+		
+        bool lookup(ADDRINT addr, Ctx &ctx)
+        {
+            ctx.idx = truncate((*hash)(addr, m_hist->folded(m_fold)), m_entries_log);
+            return ctx.pred = m_scnt.isTaken(ctx.idx);
+        }
+
+        void train(const Ctx &ctx, bool takenActually)
+        {
+            retire(ctx, takenActually);
+            speculate(takenActually);
+        }
+
+        void retire(const Ctx &ctx, bool takenActually)
+        {
+            m_scnt.train(ctx.idx, takenActually);
+        }
+
+        void speculate(bool taken)
+        {
+            if (m_own_hist)
+                m_hist->push(taken);
+        }
+
+        void repair(bool taken)
+        {
+            if (m_own_hist)
+                m_hist->repair(taken);
+        }
+
+        // A shared history is saved by its owner
+        void checkpoint(Checkpoint &cp)
+        {
+            m_scnt.checkpoint(cp);
+            if (m_own_hist)
+                m_hist->checkpoint(cp);
+        }
+
+        // A shared history is counted by its owner
+        UINT64 storageBits() const
+        {
+            return m_scnt.storageBits() + (m_own_hist ? m_hist->storageBits() : 0);
+        }
+};
+
+/* ===================================================================== */
+/* Tournament predictor: Select output by global/local selection history */
+/* ===================================================================== */
+
+// Context of a tournament lookup
+template<class Ctx0, class Ctx1>
+struct TournamentCtx
+{
+    Ctx0 ctx0;
+    Ctx1 ctx1;
+    bool pred0;
+    bool pred1;
+};
+
+// Tournament predictor composed at compile time: both sub-predictors are
+// looked up once, and their contexts are reused to train them and the selector
+template<class P0, class P1>
+class Tournament: public FusedPredictor<Tournament<P0, P1>, TournamentCtx<typename P0::Ctx, typename P1::Ctx> >
+{
+    P0* m_BP0;                      // Sub-predictors
+    P1* m_BP1;
+    SaturatingCnt m_gshr;           // Global select-history register
+
+    public:
+        typedef TournamentCtx<typename P0::Ctx, typename P1::Ctx> Ctx;
+
+        Tournament(P0* BP0, P1* BP1, size_t gshr_width = 2) : m_BP0(BP0), m_BP1(BP1), m_gshr(gshr_width) {}
+
+        // The selector is a register, not a table: each copy has its own
+        Tournament(Tournament &other, ShareTables)
+            : m_BP0(new P0(*other.m_BP0, SHARE_TABLES)), m_BP1(new P1(*other.m_BP1, SHARE_TABLES)), m_gshr(other.m_gshr) {}
+
+        ~Tournament()
+        {
+            delete m_BP0;
+            delete m_BP1;
+        }
+
+        bool lookup(ADDRINT addr, Ctx &ctx)
+        {
+            ctx.pred0 = m_BP0->lookup(addr, ctx.ctx0);
+            ctx.pred1 = m_BP1->lookup(addr, ctx.ctx1);
+            return (m_gshr.getVal() & 2) ? ctx.pred1 : ctx.pred0;
+        }
+
+        void train(const Ctx &ctx, bool takenActually)
+        {
+            retire(ctx, takenActually);
+            speculate(takenActually);
+        }
+
+        void retire(const Ctx &ctx, bool takenActually)
+        {
+            bool result0 = (ctx.pred0 == takenActually),
+                 result1 = (ctx.pred1 == takenActually);
+
+            if (!result0 && result1) {
+                if (m_gshr.getVal() == 1) {
+                    m_gshr.increase();
+                }
+
+                m_gshr.increase();
+            } else if (result0 && !result1) {
+                if (m_gshr.getVal() == 2) {
+                    m_gshr.decrease();
+                }
+
+                m_gshr.decrease();
+            }
+
+            m_BP0->retire(ctx.ctx0, takenActually);
+            m_BP1->retire(ctx.ctx1, takenActually);
+        }
+
+        void speculate(bool taken)
+        {
+            m_BP0->speculate(taken);
+            m_BP1->speculate(taken);
+        }
+
+        void repair(bool taken)
+        {
+            m_BP0->repair(taken);
+            m_BP1->repair(taken);
+        }
+
+        void checkpoint(Checkpoint &cp)
+        {
+            m_gshr.checkpoint(cp);
+            m_BP0->checkpoint(cp);
+            m_BP1->checkpoint(cp);
+        }
+
+        UINT64 storageBits() const
+        {
+            return m_gshr.storageBits() + m_BP0->storageBits() + m_BP1->storageBits();
+        }
+};
+
+/* ===================================================================== */
+/* TArget GEometric history length Predictor                             */
+/* ===================================================================== */
+
+#define TAGE_MAX_TABLES 16
+
+// Context of a TAGE lookup
+struct TAGECtx
+{
+    TableCtx base;                      // Lookup of the base predictor T0
+    UINT32 idx[TAGE_MAX_TABLES];        // Index into every tagged table
+    UINT16 tag[TAGE_MAX_TABLES];        // Partial tag for every tagged table
+    int provider;                       // Longest hitting table (0: base predictor)
+    int altpred;                        // Next longest hitting table (0: base predictor)
+    bool providerPred;
+    bool altPred;
+    bool pred;                          // Final prediction
+};
+
+// TAGE: a bimodal base predictor T0 and tagged tables T[1 : tnum - 1]
+// indexed with geometrically longer slices of one shared global history.
+// Each tagged entry holds a partial tag, a 3-bit counter and a 2-bit useful
+// counter; the fields of all tables live in flat arrays (tag, counter and
+// useful planes), table t at offset (t - 1) << Tn_entry_num_log.
+template<UINT128 (*hash1)(UINT128 pc, UINT128 ghr), UINT128 (*hash2)(UINT128 pc, UINT128 ghr)>
+class TAGEPredictor: public FusedPredictor<TAGEPredictor<hash1, hash2>, TAGECtx>
+{
+    const size_t m_tnum;            // 子预测器个数 (T[0 : m_tnum - 1])
+    const size_t m_entries_log;     // 子预测器T[1 : m_tnum - 1]的行数的对数
+    const size_t m_tag_width;       // Width of the partial tags
+
+    BHTPredictor* m_T0;             // 子预测器T0
+    UINT16* m_tag;                  // Partial tags of T[1 : m_tnum - 1]
+    bool m_own;                     // Whether m_tag is ours or another predictor's
+    PackedCounters<3> m_ctr;        // Prediction counters (taken when >= 4)
+    PackedCounters<2> m_useful;     // Useful counters
+
+    GlobalHistory m_hist;           // GHR shared by all tables
+    size_t m_fold_idx[TAGE_MAX_TABLES];     // History of T[i] folded to the index width
+    size_t m_fold_tag[TAGE_MAX_TABLES];     // ... and to the tag width
+
+    INT8 m_use_alt_on_na;           // >= 0: trust altpred over a newly allocated provider
+    UINT32 m_seed;                  // Pseudo-random allocation choice
+
+    const size_t m_rst_period;      // Aging period of the useful counters
+    size_t m_rst_cnt;               // Aging counter
+
+    // Geometric history length of table i >= 1
+    static size_t historyLength(size_t i, size_t T1ghr_len, float alpha)
+    {
+        size_t len = T1ghr_len;
+        for (size_t k = 1; k < i; k++)
+            len = (size_t)(len * alpha) > len ? (size_t)(len * alpha) : len + 1;
+        return len;
+    }
+
+    public:
+        typedef TAGECtx Ctx;
+
+        // Constructor
+        // param:   tnum:               The number of sub-predictors (at most TAGE_MAX_TABLES)
+        //          T0_entry_num_log:   子预测器T0的BHT行数的对数
+        //          T1ghr_len:          子预测器T1的历史长度
+        //          alpha:              各子预测器T[1 : m_tnum - 1]的历史长度几何倍数关系
+        //          Tn_entry_num_log:   各子预测器T[1 : m_tnum - 1]的行数的对数
+        //          tag_width:          Width of the partial tags (at most 16)
+        //          rst_period:         Aging period of the useful counters
+        TAGEPredictor(size_t tnum, size_t T0_entry_num_log, size_t T1ghr_len, float alpha, size_t Tn_entry_num_log, size_t tag_width = 9, size_t rst_period = 256*1024)
+        : m_tnum(tnum < 2 ? 2 : tnum < TAGE_MAX_TABLES ? tnum : TAGE_MAX_TABLES), m_entries_log(Tn_entry_num_log),
+          m_tag_width(tag_width < 2 ? 2 : tag_width > 16 ? 16 : tag_width),
+          m_ctr((m_tnum - 1) << Tn_entry_num_log), m_useful((m_tnum - 1) << Tn_entry_num_log, 0),
+          m_hist(historyLength(m_tnum - 1, T1ghr_len, alpha)),
+          m_use_alt_on_na(0), m_seed(0x2545f491), m_rst_period(rst_period), m_rst_cnt(0)
+        {
+            m_T0 = new BHTPredictor(T0_entry_num_log);
+            m_tag = new UINT16[(m_tnum - 1) << m_entries_log];
+            m_own = true;
+            memset(m_tag, 0, sizeof(UINT16) * ((m_tnum - 1) << m_entries_log));
+
+            for (size_t i = 1; i < m_tnum; i++)
+            {
+                size_t len = historyLength(i, T1ghr_len, alpha);
+                m_fold_idx[i] = m_hist.fold(len, m_entries_log);
+                m_fold_tag[i] = m_hist.fold(len, m_tag_width);
+            }
+        }
+
+        // The tables of other, with copies of its history, use_alt_on_na,
+        // allocation LFSR and aging counter
+        TAGEPredictor(TAGEPredictor &other, ShareTables)
+        : m_tnum(other.m_tnum), m_entries_log(other.m_entries_log), m_tag_width(other.m_tag_width),
+          m_T0(new BHTPredictor(*other.m_T0, SHARE_TABLES)), m_tag(other.m_tag), m_own(false),
+          m_ctr(other.m_ctr, SHARE_TABLES), m_useful(other.m_useful, SHARE_TABLES), m_hist(other.m_hist),
+          m_use_alt_on_na(other.m_use_alt_on_na), m_seed(other.m_seed), m_rst_period(other.m_rst_period),
+          m_rst_cnt(other.m_rst_cnt)
+        {
+            memcpy(m_fold_idx, other.m_fold_idx, sizeof(m_fold_idx));
+            memcpy(m_fold_tag, other.m_fold_tag, sizeof(m_fold_tag));
+        }
+
+        ~TAGEPredictor()
+        {
+            delete m_T0;
+            if (m_own)
+                delete[] m_tag;
+        }
+
+        bool lookup(ADDRINT addr, Ctx &ctx)
+        {
+            ctx.provider = 0;
+            ctx.altpred = 0;
+            bool basePred = m_T0->lookup(addr, ctx.base);
+
+            // 从短到长查找, 最长的命中为provider, 次长的为altpred
+            for (size_t i = 1; i < m_tnum; i++) {
+                UINT64 fold_idx = m_hist.folded(m_fold_idx[i]);
+                ctx.idx[i] = ((i - 1) << m_entries_log)
+                    | truncate((*hash1)(addr ^ (addr >> m_entries_log), fold_idx), m_entries_log);
+
+                // The other folding of the same history decorrelates tag and index
+                ctx.tag[i] = truncate((*hash2)(addr, m_hist.folded(m_fold_tag[i]) ^ (fold_idx << 1)), m_tag_width);
+
+                if (m_tag[ctx.idx[i]] == ctx.tag[i]) {
+                    ctx.altpred = ctx.provider;
+                    ctx.provider = i;
+                }
+            }
+
+            ctx.altPred = ctx.altpred ? m_ctr.isTaken(ctx.idx[ctx.altpred]) : basePred;
+            if (ctx.provider == 0)
+                return ctx.pred = ctx.providerPred = basePred;
+
+            // A weak provider entry with no useful history has likely just
+            // been allocated; use_alt_on_na decides whether to trust it
+            UINT32 p = ctx.idx[ctx.provider];
+            UINT8 ctr = m_ctr.get(p);
+            ctx.providerPred = ctr >= 4;
+
+            bool newEntry = (ctr == 3 || ctr == 4) && m_useful.get(p) == 0;
+            ctx.pred = (newEntry && m_use_alt_on_na >= 0) ? ctx.altPred : ctx.providerPred;
+            return ctx.pred;
+        }
+
+        void train(const Ctx &ctx, bool takenActually)
+        {
+            retire(ctx, takenActually);
+            speculate(takenActually);
+        }
+
+        void speculate(bool taken) { m_hist.push(taken); }
+        void repair(bool taken) { m_hist.repair(taken); }
+
+        void retire(const Ctx &ctx, bool takenActually)
+        {
+            // 周期性地将useful减半 (graceful aging)
+            if (++m_rst_cnt == m_rst_period) {
+                m_useful.age();
+                m_rst_cnt = 0;
+            }
+
+            if (ctx.provider > 0) {
+                UINT32 p = ctx.idx[ctx.provider];
+                UINT8 ctr = m_ctr.get(p);
+
+                // Learn whether altpred beats newly allocated entries
+                if ((ctr == 3 || ctr == 4) && m_useful.get(p) == 0 && ctx.providerPred != ctx.altPred) {
+                    if (ctx.altPred == takenActually) {
+                        if (m_use_alt_on_na < 7) m_use_alt_on_na++;
+                    } else {
+                        if (m_use_alt_on_na > -8) m_use_alt_on_na--;
+                    }
+                }
+            }
+
+            // 预测错误时在更长的表中分配表项
+            if (ctx.pred != takenActually && ctx.provider < (int)m_tnum - 1) {
+                int first = -1, count = 0;
+                for (size_t i = ctx.provider + 1; i < m_tnum; i++) {
+                    if (m_useful.get(ctx.idx[i]) == 0) {
+                        if (first < 0)
+                            first = i;
+                        count++;
+                    }
+                }
+
+                if (first < 0) {
+                    // No free entry: make the candidates easier to replace
+                    for (size_t i = ctx.provider + 1; i < m_tnum; i++)
+                        m_useful.decrease(ctx.idx[i]);
+                } else {
+                    // Prefer the shortest free table, sometimes skip to the next one
+                    m_seed ^= m_seed << 13;
+                    m_seed ^= m_seed >> 17;
+                    m_seed ^= m_seed << 5;
+
+                    size_t i = first;
+                    if (count > 1 && (m_seed & 1)) {
+                        for (i = first + 1; m_useful.get(ctx.idx[i]) != 0; i++)
+                            ;
+                    }
+
+                    m_tag[ctx.idx[i]] = ctx.tag[i];
+                    m_ctr.set(ctx.idx[i], takenActually ? 4 : 3);
+                }
+            }
+
+            // 更新provider, 表项尚无用时同时更新altpred
+            if (ctx.provider == 0) {
+                m_T0->train(ctx.base, takenActually);
+            } else {
+                UINT32 p = ctx.idx[ctx.provider];
+                if (takenActually)
+                    m_ctr.increase(p);
+                else
+                    m_ctr.decrease(p);
+
+                if (m_useful.get(p) == 0) {
+                    if (ctx.altpred == 0) {
+                        m_T0->train(ctx.base, takenActually);
+                    } else if (takenActually) {
+                        m_ctr.increase(ctx.idx[ctx.altpred]);
+                    } else {
+                        m_ctr.decrease(ctx.idx[ctx.altpred]);
+                    }
+                }
+
+                // 更新useful: provider与altpred不同时, 按provider的对错增减
+                if (ctx.providerPred != ctx.altPred) {
+                    if (ctx.providerPred == takenActually)
+                        m_useful.increase(p);
+                    else
+                        m_useful.decrease(p);
+                }
+            }
+        }
+
+        void checkpoint(Checkpoint &cp)
+        {
+            m_T0->checkpoint(cp);
+            cp.bytes(m_tag, sizeof(UINT16) * ((m_tnum - 1) << m_entries_log));
+            m_ctr.checkpoint(cp);
+            m_useful.checkpoint(cp);
+            m_hist.checkpoint(cp);
+            cp.value(m_use_alt_on_na);
+            cp.value(m_seed);
+            cp.value(m_rst_cnt);
+        }
+
+        // Tables, history, use_alt_on_na, allocation LFSR and aging counter
+        UINT64 storageBits() const
+        {
+            return m_T0->storageBits() + (UINT64)m_tag_width * ((m_tnum - 1) << m_entries_log)
+                + m_ctr.storageBits() + m_useful.storageBits() + m_hist.storageBits()
+                + 4 + 32 + counterBits(m_rst_period);
+        }
+};
+
+/* ===================================================================== */
+/* Perceptron predictor                                                  */
+/* ===================================================================== */
+
+// Kernels of the perceptron predictor over n int8 lanes (n a multiple of
+// PERCEPTRON_LANES). The history is kept as a byte mask, 0 for taken (+1)
+// and -1 for not taken (-1), so w * x is a conditional negation.
+#if defined(__AVX2__)
+#define PERCEPTRON_LANES 32
+
+// y = sum(w[i] * x[i])
+inline int perceptronDot(const INT8* w, const INT8* x, size_t n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+
+    for (size_t i = 0; i < n; i += 32) {
+        __m256i m = _mm256_load_si256((const __m256i*)(x + i));
+        __m256i s = _mm256_sub_epi8(_mm256_xor_si256(_mm256_load_si256((const __m256i*)(w + i)), m), m);
+
+        // Sign-extend to 16 bits and add pairwise into 32-bit lanes
+        __m256i lo = _mm256_srai_epi16(_mm256_unpacklo_epi8(s, s), 8);
+        __m256i hi = _mm256_srai_epi16(_mm256_unpackhi_epi8(s, s), 8);
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_add_epi16(lo, hi), ones));
+    }
+
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+    return _mm_cvtsi128_si32(sum);
+}
+
+// w[i] += t * x[i] where valid[i], saturating to [-127, 127]
+inline void perceptronTrain(INT8* w, const INT8* x, const INT8* valid, size_t n, bool taken)
+{
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i min = _mm256_set1_epi8(-127);
+    const __m256i t = _mm256_set1_epi8(taken ? 0 : -1);
+
+    for (size_t i = 0; i < n; i += 32) {
+        __m256i m = _mm256_xor_si256(_mm256_load_si256((const __m256i*)(x + i)), t);
+        __m256i d = _mm256_and_si256(_mm256_or_si256(m, one), _mm256_load_si256((const __m256i*)(valid + i)));
+        __m256i v = _mm256_adds_epi8(_mm256_load_si256((const __m256i*)(w + i)), d);
+        _mm256_store_si256((__m256i*)(w + i), _mm256_max_epi8(v, min));
+    }
+}
+#elif defined(__SSE2__)
+#define PERCEPTRON_LANES 16
+
+inline int perceptronDot(const INT8* w, const INT8* x, size_t n)
+{
+    __m128i acc = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+
+    for (size_t i = 0; i < n; i += 16) {
+        __m128i m = _mm_load_si128((const __m128i*)(x + i));
+        __m128i s = _mm_sub_epi8(_mm_xor_si128(_mm_load_si128((const __m128i*)(w + i)), m), m);
+
+        __m128i lo = _mm_srai_epi16(_mm_unpacklo_epi8(s, s), 8);
+        __m128i hi = _mm_srai_epi16(_mm_unpackhi_epi8(s, s), 8);
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_add_epi16(lo, hi), ones));
+    }
+
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4e));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xb1));
+    return _mm_cvtsi128_si32(acc);
+}
+
+inline void perceptronTrain(INT8* w, const INT8* x, const INT8* valid, size_t n, bool taken)
+{
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i low = _mm_set1_epi8(-128);
+    const __m128i t = _mm_set1_epi8(taken ? 0 : -1);
+
+    for (size_t i = 0; i < n; i += 16) {
+        __m128i m = _mm_xor_si128(_mm_load_si128((const __m128i*)(x + i)), t);
+        __m128i d = _mm_and_si128(_mm_or_si128(m, one), _mm_load_si128((const __m128i*)(valid + i)));
+        __m128i v = _mm_adds_epi8(_mm_load_si128((const __m128i*)(w + i)), d);
+
+        // SSE2 has no signed byte max: lift -128 back to -127
+        v = _mm_add_epi8(v, _mm_and_si128(_mm_cmpeq_epi8(v, low), one));
+        _mm_store_si128((__m128i*)(w + i), v);
+    }
+}
+#else
+#define PERCEPTRON_LANES 1
+
+inline int perceptronDot(const INT8* w, const INT8* x, size_t n)
+{
+    int y = 0;
+    for (size_t i = 0; i < n; i++)
+        y += x[i] ? -w[i] : w[i];
+    return y;
+}
+
+inline void perceptronTrain(INT8* w, const INT8* x, const INT8* valid, size_t n, bool taken)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (!valid[i])
+            continue;
+
+        if ((x[i] == 0) == taken) {
+            if (w[i] < 127) w[i]++;
+        } else {
+            if (w[i] > -127) w[i]--;
+        }
+    }
+}
+#endif
+
+// Context of a perceptron lookup
+struct PerceptronCtx
+{
+    INT8* w;                            // Weights of the branch
+    int y;                              // Perceptron output
+    bool pred;
+};
+
+// Perceptron predictor (Jimenez & Lin): a table of int8 weight vectors
+// indexed by PC, dotted with the global history as +1/-1 inputs. Weight 0
+// is the bias, with a constant +1 input.
+class PerceptronPredictor: public FusedPredictor<PerceptronPredictor, PerceptronCtx>
+{
+    size_t m_entries_log;
+    size_t m_ghr_len;
+    size_t m_lanes;                     // Weights per row: ghr_len + 1, rounded up to PERCEPTRON_LANES
+    int m_theta;                        // Training threshold
+
+    INT8* m_mem;                        // Holds m_weights; NULL if they are another predictor's
+    INT8* m_input_mem;                  // Holds m_x and m_valid
+    INT8* m_weights;                    // 2^entries_log rows of m_lanes weights
+    INT8* m_x;                          // Inputs: bias, then the newest outcome first
+    INT8* m_valid;                      // -1 on the lanes backed by a real input
+
+    // Rows and inputs start on a vector boundary: int8 lanes, so the kernel
+    // width in bytes is PERCEPTRON_LANES
+    static INT8* align(INT8* mem)
+    {
+        return (INT8*)(((ADDRINT)mem + PERCEPTRON_LANES - 1) & ~(ADDRINT)(PERCEPTRON_LANES - 1));
+    }
+
+    void newInputs()
+    {
+        m_input_mem = new INT8[2 * m_lanes + PERCEPTRON_LANES];
+        m_x = align(m_input_mem);
+        m_valid = m_x + m_lanes;
+    }
+
+    public:
+        typedef PerceptronCtx Ctx;
+
+        // Constructor
+        // param:   entry_num_log:  Log of the number of perceptrons
+        //          ghr_len:        Global history length
+        PerceptronPredictor(size_t entry_num_log, size_t ghr_len)
+            : m_entries_log(entry_num_log), m_ghr_len(ghr_len ? ghr_len : 1)
+        {
+            m_lanes = (m_ghr_len + PERCEPTRON_LANES) / PERCEPTRON_LANES * PERCEPTRON_LANES;
+            m_theta = (int)(1.93 * m_ghr_len + 14);
+
+            size_t rows = (size_t)1 << entry_num_log;
+            m_mem = new INT8[rows * m_lanes + PERCEPTRON_LANES];
+            m_weights = align(m_mem);
+            newInputs();
+
+            memset(m_weights, 0, rows * m_lanes);
+            memset(m_x, 0, m_lanes);
+            memset(m_valid, 0, m_lanes);
+            memset(m_valid, -1, m_ghr_len + 1);
+        }
+
+        // The weights of other, with a copy of its history
+        PerceptronPredictor(PerceptronPredictor &other, ShareTables)
+            : m_entries_log(other.m_entries_log), m_ghr_len(other.m_ghr_len), m_lanes(other.m_lanes),
+              m_theta(other.m_theta), m_mem(NULL), m_weights(other.m_weights)
+        {
+            newInputs();
+            memcpy(m_x, other.m_x, m_lanes);
+            memcpy(m_valid, other.m_valid, m_lanes);
+        }
+
+        ~PerceptronPredictor()
+        {
+            delete[] m_mem;
+            delete[] m_input_mem;
+        }
+
+        bool lookup(ADDRINT addr, Ctx &ctx)
+        {
+            ctx.w = m_weights + (size_t)truncate(addr, m_entries_log) * m_lanes;
+            ctx.y = perceptronDot(ctx.w, m_x, m_lanes);
+            return ctx.pred = ctx.y >= 0;
+        }
+
+        void train(const Ctx &ctx, bool takenActually)
+        {
+            if (ctx.pred != takenActually || abs(ctx.y) <= m_theta)
+                perceptronTrain(ctx.w, m_x, m_valid, m_lanes, takenActually);
+
+            // Shift the outcome into the history; lane 0 stays the bias input
+            memmove(m_x + 2, m_x + 1, m_ghr_len - 1);
+            m_x[1] = takenActually ? 0 : -1;
+        }
+
+        // The padding lanes stay 0, so only the real weights and inputs are
+        // saved: the checkpoint does not depend on the kernel built
+        void checkpoint(Checkpoint &cp)
+        {
+            for (size_t row = 0; row < ((size_t)1 << m_entries_log); row++)
+                cp.bytes(m_weights + row * m_lanes, m_ghr_len + 1);
+            cp.bytes(m_x, m_ghr_len + 1);
+        }
+
+        // 8-bit weights (without the SIMD padding) and the history
+        UINT64 storageBits() const
+        {
+            return ((UINT64)8 * (m_ghr_len + 1) << m_entries_log) + m_ghr_len;
+        }
+};
+
+/* ===================================================================== */
+/* Loop predictor                                                        */
+/* ===================================================================== */
+
+#define LOOP_WAYS       4
+#define LOOP_ITER_MAX   ((1 << 14) - 1)
+#define LOOP_CONF_MAX   3
+#define LOOP_AGE_MAX    255
+
+// Context of a loop predictor lookup
+struct LoopCtx
+{
+    UINT32 set;                         // First entry of the set of the branch
+    UINT16 tag;
+    UINT32 entry;                       // Entry of the branch, if hit
+    bool hit;
+    bool valid;                         // The entry is confident
+    bool pred;
+};
+
+// Loop predictor as in L-TAGE: a set-associative table of loop branches,
+// each with the trip count seen last (pastIter), the iterations of the
+// running instance (currentIter) and a confidence that the trip count
+// repeats. A confident entry predicts the exit on the last iteration.
+class LoopPredictor
+{
+    struct Entry
+    {
+        UINT16 tag;
+        UINT16 pastIter;
+        UINT16 currentIter;
+        UINT8 confidence;
+        UINT8 age;                      // Replacement: 0 may be evicted
+        bool dir;                       // Direction of the loop body
+    };
+
+    size_t m_sets_log;
+    Entry* m_entries;
+    bool m_own;                         // Whether m_entries is ours or another predictor's
+
+    static const size_t TAG_WIDTH = 14;
+
+    public:
+        LoopPredictor(size_t entry_num_log = 8)
+            : m_sets_log(entry_num_log > 2 ? entry_num_log - 2 : 0), m_own(true)
+        {
+            m_entries = new Entry[LOOP_WAYS << m_sets_log];
+            memset(m_entries, 0, sizeof(Entry) * (LOOP_WAYS << m_sets_log));
+        }
+
+        LoopPredictor(LoopPredictor &other, ShareTables)
+            : m_sets_log(other.m_sets_log), m_entries(other.m_entries), m_own(false) {}
+
+        ~LoopPredictor()
+        {
+            if (m_own)
+                delete[] m_entries;
+        }
+
+        bool lookup(ADDRINT addr, LoopCtx &ctx)
+        {
+            ctx.set = truncate(addr ^ (addr >> m_sets_log), m_sets_log) * LOOP_WAYS;
+            ctx.tag = truncate(addr >> m_sets_log, TAG_WIDTH);
+
+            ctx.hit = false;
+            ctx.valid = false;
+            ctx.pred = false;
+            for (size_t w = 0; w < LOOP_WAYS; w++)
+            {
+                Entry &e = m_entries[ctx.set + w];
+                if (e.tag != ctx.tag || e.age == 0)
+                    continue;
+
+                ctx.entry = ctx.set + w;
+                ctx.hit = true;
+                ctx.valid = e.confidence == LOOP_CONF_MAX;
+                ctx.pred = e.currentIter + 1 == e.pastIter ? !e.dir : e.dir;
+                break;
+            }
+            return ctx.pred;
+        }
+
+        // mainPred: prediction of the main predictor, which decides when
+        // a branch is worth an entry
+        void train(const LoopCtx &ctx, bool takenActually, bool mainPred)
+        {
+            if (!ctx.hit)
+            {
+                // Allocate on a misprediction of the main predictor, taking
+                // the outcome as a loop exit
+                if (mainPred == takenActually)
+                    return;
+
+                for (size_t w = 0; w < LOOP_WAYS; w++)
+                {
+                    Entry &e = m_entries[ctx.set + w];
+                    if (e.age == 0)
+                    {
+                        e.tag = ctx.tag;
+                        e.pastIter = 0;
+                        e.currentIter = 0;
+                        e.confidence = 0;
+                        e.age = LOOP_AGE_MAX;
+                        e.dir = !takenActually;
+                        return;
+                    }
+                }
+
+                for (size_t w = 0; w < LOOP_WAYS; w++)
+                    m_entries[ctx.set + w].age--;
+                return;
+            }
+
+            Entry &e = m_entries[ctx.entry];
+            if (ctx.valid)
+            {
+                // A wrong confident prediction: not a fixed-trip-count loop
+                if (ctx.pred != takenActually)
+                {
+                    e.age = 0;
+                    return;
+                }
+                if (ctx.pred != mainPred && e.age < LOOP_AGE_MAX)
+                    e.age++;
+            }
+
+            if (++e.currentIter >= LOOP_ITER_MAX)
+            {
+                e.age = 0;
+                return;
+            }
+
+            if (takenActually != e.dir)
+            {
+                // Loop exit: the confidence grows while the trip count repeats
+                if (e.currentIter == e.pastIter)
+                {
+                    if (e.confidence < LOOP_CONF_MAX)
+                        e.confidence++;
+                }
+                else
+                {
+                    e.pastIter = e.currentIter;
+                    e.confidence = 0;
+                }
+                e.currentIter = 0;
+            }
+        }
+
+        void checkpoint(Checkpoint &cp) { cp.bytes(m_entries, sizeof(Entry) * (LOOP_WAYS << m_sets_log)); }
+
+        // Tag, two iteration counts, confidence, age and direction per entry
+        UINT64 storageBits() const
+        {
+            return (UINT64)(LOOP_WAYS << m_sets_log)
+                * (TAG_WIDTH + 2 * counterBits(LOOP_ITER_MAX + 1) + counterBits(LOOP_CONF_MAX + 1) + counterBits(LOOP_AGE_MAX + 1) + 1);
+        }
+};
+
+// Context of a lookup of WithLoop<P>
+template<class Ctx0>
+struct WithLoopCtx
+{
+    Ctx0 inner;
+    LoopCtx loop;
+    bool innerPred;
+    bool pred;
+};
+
+// P with a loop predictor that overrides it when confident, as long as a
+// global counter says the overrides pay off
+template<class P>
+class WithLoop: public FusedPredictor<WithLoop<P>, WithLoopCtx<typename P::Ctx> >
+{
+    P* m_BP;
+    LoopPredictor m_loop;
+    INT8 m_with_loop;                   // >= 0: trust the loop predictor
+
+    public:
+        typedef WithLoopCtx<typename P::Ctx> Ctx;
+
+        WithLoop(P* BP, size_t loop_entry_num_log = 8) : m_BP(BP), m_loop(loop_entry_num_log), m_with_loop(-1) {}
+
+        WithLoop(WithLoop &other, ShareTables)
+            : m_BP(new P(*other.m_BP, SHARE_TABLES)), m_loop(other.m_loop, SHARE_TABLES), m_with_loop(other.m_with_loop) {}
+
+        ~WithLoop() { delete m_BP; }
+
+        bool lookup(ADDRINT addr, Ctx &ctx)
+        {
+            ctx.innerPred = m_BP->lookup(addr, ctx.inner);
+            bool loopPred = m_loop.lookup(addr, ctx.loop);
+            return ctx.pred = (ctx.loop.valid && m_with_loop >= 0) ? loopPred : ctx.innerPred;
+        }
+
+        void train(const Ctx &ctx, bool takenActually)
+        {
+            retire(ctx, takenActually);
+            speculate(takenActually);
+        }
+
+        void retire(const Ctx &ctx, bool takenActually)
+        {
+            if (ctx.loop.valid && ctx.loop.pred != ctx.innerPred)
+            {
+                if (ctx.loop.pred == takenActually) {
+                    if (m_with_loop < 63) m_with_loop++;
+                } else {
+                    if (m_with_loop > -64) m_with_loop--;
+                }
+            }
+
+            m_loop.train(ctx.loop, takenActually, ctx.innerPred);
+            m_BP->retire(ctx.inner, takenActually);
+        }
+
+        void speculate(bool taken) { m_BP->speculate(taken); }
+        void repair(bool taken) { m_BP->repair(taken); }
+
+        void checkpoint(Checkpoint &cp)
+        {
+            m_BP->checkpoint(cp);
+            m_loop.checkpoint(cp);
+            cp.value(m_with_loop);
+        }
+
+        UINT64 storageBits() const { return m_BP->storageBits() + m_loop.storageBits() + 7; }
+};
+
+/* ===================================================================== */
+/* Statistical corrector                                                 */
+/* ===================================================================== */
+
+#define SC_TABLES 4
+
+// Context of a lookup of WithSC<P>
+template<class Ctx0>
+struct WithSCCtx
+{
+    Ctx0 inner;
+    UINT32 idx[SC_TABLES];
+    int sum;                            // Centered sum of the counters
+    bool innerPred;
+    bool pred;
+};
+
+// P with a statistical corrector as in TAGE-SC: tables of 6-bit signed
+// counters indexed with the PC, the prediction of P and global histories of
+// 0, 4, 8 and 16 outcomes. Their sum agrees with P on branches P handles
+// well; where it is strong enough to disagree, the prediction is inverted.
+// The threshold adapts to how often the inversions are right.
+template<class P>
+class WithSC: public FusedPredictor<WithSC<P>, WithSCCtx<typename P::Ctx> >
+{
+    P* m_BP;
+    size_t m_entries_log;
+    INT8* m_ctr;                        // SC_TABLES tables of 2^entries_log counters
+    bool m_own;                         // Whether m_ctr is ours or another predictor's
+    GlobalHistory m_hist;
+    size_t m_fold[SC_TABLES];
+    int m_threshold;
+    int m_tc;                           // Threshold training counter
+
+    static const int CTR_MAX = 31;
+    static const int CTR_MIN = -32;
+
+    public:
+        typedef WithSCCtx<typename P::Ctx> Ctx;
+
+        WithSC(P* BP, size_t entry_num_log = 10)
+            : m_BP(BP), m_entries_log(entry_num_log), m_own(true), m_hist(16), m_threshold(6 * SC_TABLES), m_tc(0)
+        {
+            static const size_t lengths[SC_TABLES] = { 0, 4, 8, 16 };
+
+            m_ctr = new INT8[SC_TABLES << m_entries_log];
+            memset(m_ctr, 0, SC_TABLES << m_entries_log);
+            for (size_t i = 1; i < SC_TABLES; i++)
+                m_fold[i] = m_hist.fold(lengths[i], m_entries_log - 1);
+        }
+
+        // The counters of other, with copies of its history and threshold
+        WithSC(WithSC &other, ShareTables)
+            : m_BP(new P(*other.m_BP, SHARE_TABLES)), m_entries_log(other.m_entries_log), m_ctr(other.m_ctr),
+              m_own(false), m_hist(other.m_hist), m_threshold(other.m_threshold), m_tc(other.m_tc)
+        {
+            memcpy(m_fold, other.m_fold, sizeof(m_fold));
+        }
+
+        ~WithSC()
+        {
+            delete m_BP;
+            if (m_own)
+                delete[] m_ctr;
+        }
+
+        bool lookup(ADDRINT addr, Ctx &ctx)
+        {
+            ctx.innerPred = m_BP->lookup(addr, ctx.inner);
+
+            // The first table only sees the PC and the prediction of P
+            ctx.sum = 0;
+            for (size_t i = 0; i < SC_TABLES; i++)
+            {
+                UINT64 h = i ? m_hist.folded(m_fold[i]) * (2 * i + 1) : 0;
+                ctx.idx[i] = (i << m_entries_log)
+                    | (truncate(addr ^ (addr >> (m_entries_log - 1)) ^ h, m_entries_log - 1) << 1) | ctx.innerPred;
+                ctx.sum += 2 * m_ctr[ctx.idx[i]] + 1;
+            }
+
+            bool scPred = ctx.sum >= 0;
+            return ctx.pred = (scPred != ctx.innerPred && abs(ctx.sum) >= m_threshold) ? scPred : ctx.innerPred;
+        }
+
+        void train(const Ctx &ctx, bool takenActually)
+        {
+            retire(ctx, takenActually);
+            speculate(takenActually);
+        }
+
+        void retire(const Ctx &ctx, bool takenActually)
+        {
+            bool scPred = ctx.sum >= 0;
+
+            // Move the threshold towards the point where inverting pays off
+            if (scPred != ctx.innerPred && abs(ctx.sum) >= m_threshold - 4 && abs(ctx.sum) <= m_threshold + 4)
+            {
+                m_tc += scPred == takenActually ? -1 : 1;
+                if (m_tc > 31) {
+                    m_threshold++;
+                    m_tc = 0;
+                } else if (m_tc < -32) {
+                    if (m_threshold > SC_TABLES) m_threshold--;
+                    m_tc = 0;
+                }
+            }
+
+            if (scPred != takenActually || abs(ctx.sum) < 2 * m_threshold)
+            {
+                for (size_t i = 0; i < SC_TABLES; i++)
+                {
+                    INT8 &c = m_ctr[ctx.idx[i]];
+                    if (takenActually) {
+                        if (c < CTR_MAX) c++;
+                    } else {
+                        if (c > CTR_MIN) c--;
+                    }
+                }
+            }
+
+            m_BP->retire(ctx.inner, takenActually);
+        }
+
+        void speculate(bool taken)
+        {
+            m_hist.push(taken);
+            m_BP->speculate(taken);
+        }
+
+        void repair(bool taken)
+        {
+            m_hist.repair(taken);
+            m_BP->repair(taken);
+        }
+
+        void checkpoint(Checkpoint &cp)
+        {
+            m_BP->checkpoint(cp);
+            cp.bytes(m_ctr, SC_TABLES << m_entries_log);
+            m_hist.checkpoint(cp);
+            cp.value(m_threshold);
+            cp.value(m_tc);
+        }
+
+        // 6-bit counters, history, threshold and its training counter
+        UINT64 storageBits() const
+        {
+            return m_BP->storageBits() + ((UINT64)6 * SC_TABLES << m_entries_log) + m_hist.storageBits() + 8 + 6;
+        }
+};
+
+/* ===================================================================== */
+/* Delayed update: predict ahead, train at retirement                    */
+/* ===================================================================== */
+
+// Runs P as a pipelined front end does: up to depth branches are in flight
+// between lookup and retirement, and once the queue is full the oldest
+// batch of them retire together, training the tables with contexts looked
+// up depth branches earlier. The history is updated speculatively with the
+// prediction and repaired on a misprediction. Only the correct path is
+// simulated, so the repair happens before the next branch is looked up.
+template<class P>
+class DelayedUpdate: public BranchPredictor
+{
+    struct InFlight
+    {
+        typename P::Ctx ctx;
+        bool pred;
+        bool taken;
+    };
+
+    P* m_BP;
+    std::vector<InFlight> m_queue;      // Circular, oldest at m_head
+    size_t m_head;
+    size_t m_count;
+    size_t m_batch;                     // Branches retired at once
+
+    public:
+        DelayedUpdate(P* BP, size_t depth, size_t batch = 1)
+            : m_BP(BP), m_queue(depth ? depth : 1), m_head(0), m_count(0),
+              m_batch(batch < 1 ? 1 : batch > m_queue.size() ? m_queue.size() : batch) {}
+
+        ~DelayedUpdate() { delete m_BP; }
+
+        // Look the branch up into the next free slot and push the prediction
+        // into the history; the oldest batch retires first if the queue is full
+        bool predict(ADDRINT addr)
+        {
+            if (m_count == m_queue.size())
+            {
+                for (size_t i = 0; i < m_batch; i++)
+                {
+                    m_BP->retire(m_queue[m_head].ctx, m_queue[m_head].taken);
+                    m_head = (m_head + 1) % m_queue.size();
+                }
+                m_count -= m_batch;
+            }
+
+            InFlight &f = m_queue[(m_head + m_count) % m_queue.size()];
+            f.pred = m_BP->lookup(addr, f.ctx);
+            m_BP->speculate(f.pred);
+            return f.pred;
+        }
+
+        // Put the branch of the last predict() in flight with its outcome
+        void update(bool takenActually, bool takenPredicted, ADDRINT addr)
+        {
+            InFlight &f = m_queue[(m_head + m_count) % m_queue.size()];
+            f.taken = takenActually;
+            m_count++;
+
+            if (f.pred != takenActually)
+                m_BP->repair(takenActually);
+        }
+
+        bool access(ADDRINT addr, bool takenActually)
+        {
+            bool takenPredicted = DelayedUpdate::predict(addr);
+            DelayedUpdate::update(takenActually, takenPredicted, addr);
+            return takenPredicted;
+        }
+
+        // The branches in flight are saved with the predictor, so a run
+        // resumed from the checkpoint retires them as the full run does
+        void checkpoint(Checkpoint &cp)
+        {
+            m_BP->checkpoint(cp);
+            cp.value(m_head);
+            cp.value(m_count);
+            cp.bytes(&m_queue[0], m_queue.size() * sizeof(InFlight));
+
+            if (m_head >= m_queue.size() || m_count > m_queue.size())
+                m_head = m_count = 0;
+        }
+
+        // The queue belongs to the pipeline, not to the predictor
+        UINT64 storageBits() const { return m_BP->storageBits(); }
+
+        // Each thread has a pipeline, and so a queue, of its own
+        BranchPredictor* shareTables()
+        {
+            return new DelayedUpdate<P>(new P(*m_BP, SHARE_TABLES), m_queue.size(), m_batch);
+        }
+};
+
+// BP itself, or BP behind an update queue of the given depth
+template<class P>
+BranchPredictor* withDelay(P* BP, size_t depth, size_t batch)
+{
+    if (depth == 0)
+        return BP;
+    return new DelayedUpdate<P>(BP, depth, batch);
+}
+
+// BP with the optional loop predictor and statistical corrector, then the
+// optional update queue
+template<class P>
+BranchPredictor* compose(P* BP, bool loop, bool sc, size_t depth, size_t batch)
+{
+    if (loop && sc)
+        return withDelay(new WithSC<WithLoop<P> >(new WithLoop<P>(BP)), depth, batch);
+    if (loop)
+        return withDelay(new WithLoop<P>(BP), depth, batch);
+    if (sc)
+        return withDelay(new WithSC<P>(BP), depth, batch);
+    return withDelay(BP, depth, batch);
+}
+
+/* ===================================================================== */
+/* Predictor bank: many configurations fed with the same branches        */
+/* ===================================================================== */
+
+// Outcome counters of one predictor
+struct BranchStats
+{
+    UINT64 takenCorrect;
+    UINT64 takenIncorrect;
+    UINT64 notTakenCorrect;
+    UINT64 notTakenIncorrect;
+
+    BranchStats() : takenCorrect(0), takenIncorrect(0), notTakenCorrect(0), notTakenIncorrect(0) {}
+
+    void count(bool takenPredicted, bool takenActually)
+    {
+        if (takenPredicted)
+        {
+            if (takenActually)
+                takenCorrect++;
+            else
+                takenIncorrect++;
+        }
+        else
+        {
+            if (takenActually)
+                notTakenIncorrect++;
+            else
+                notTakenCorrect++;
+        }
+    }
+
+    void merge(const BranchStats &other)
+    {
+        takenCorrect += other.takenCorrect;
+        takenIncorrect += other.takenIncorrect;
+        notTakenCorrect += other.notTakenCorrect;
+        notTakenIncorrect += other.notTakenIncorrect;
+    }
+
+    UINT64 total() const { return takenCorrect + takenIncorrect + notTakenCorrect + notTakenIncorrect; }
+
+    UINT64 mispredicted() const { return takenIncorrect + notTakenIncorrect; }
+
+    double precision() const { return 100 * double(takenCorrect + notTakenCorrect) / total(); }
+
+    // With the instruction count, the mispredictions per kilo-instruction too
+    void write(std::ostream &out, UINT64 instructions = 0) const
+    {
+        out << "takenCorrect: " << takenCorrect << std::endl
+            << "takenIncorrect: " << takenIncorrect << std::endl
+            << "notTakenCorrect: " << notTakenCorrect << std::endl
+            << "nnotTakenIncorrect: " << notTakenIncorrect << std::endl
+            << "Precision: " << precision() << std::endl;
+        if (instructions)
+            out << "MPKI: " << 1000 * double(mispredicted()) / instructions << std::endl;
+    }
+};
+
+// Per-branch execution and misprediction counts, kept in an open-addressed
+// hash table (linear probing, PC 0 marks a free slot) that doubles once it is
+// 3/4 full
+class BranchProfile
+{
+    public:
+        struct Entry
+        {
+            ADDRINT pc;
+            UINT64 executed;
+            UINT64 taken;
+            UINT64 mispredicted;
+
+            // Fraction of the executions going the majority way
+            double bias() const
+            {
+                UINT64 major = taken * 2 >= executed ? taken : executed - taken;
+                return 100 * double(major) / executed;
+            }
+        };
+
+    private:
+        std::vector<Entry> m_table;
+        size_t m_mask;
+        size_t m_used;
+
+        size_t slot(ADDRINT pc) const
+        {
+            // Fibonacci hashing spreads the low, aligned PC bits
+            size_t i = (size_t)((pc * 0x9e3779b97f4a7c15ULL) >> 32) & m_mask;
+            while (m_table[i].pc != pc && m_table[i].pc != 0)
+                i = (i + 1) & m_mask;
+            return i;
+        }
+
+        void grow()
+        {
+            std::vector<Entry> old;
+            old.swap(m_table);
+            m_table.assign(old.size() * 2, Entry());
+            m_mask = m_table.size() - 1;
+
+            for (size_t i = 0; i < old.size(); i++)
+                if (old[i].pc)
+                    m_table[slot(old[i].pc)] = old[i];
+        }
+
+    public:
+        BranchProfile(size_t capacity_log = 12)
+            : m_table((size_t)1 << capacity_log, Entry()),
+              m_mask(((size_t)1 << capacity_log) - 1), m_used(0) {}
+
+        // The entry of pc, inserted if it is new
+        Entry &find(ADDRINT pc)
+        {
+            size_t i = slot(pc);
+            if (m_table[i].pc == 0)
+            {
+                if (4 * (m_used + 1) > 3 * m_table.size())
+                {
+                    grow();
+                    i = slot(pc);
+                }
+                m_table[i].pc = pc;
+                m_used++;
+            }
+            return m_table[i];
+        }
+
+        void count(ADDRINT pc, bool takenPredicted, bool takenActually)
+        {
+            Entry &e = find(pc);
+            e.executed++;
+            e.taken += takenActually;
+            e.mispredicted += takenPredicted != takenActually;
+        }
+
+        // Add the counts of other, e.g. of another thread
+        void merge(const BranchProfile &other)
+        {
+            for (size_t i = 0; i < other.m_table.size(); i++)
+            {
+                const Entry &o = other.m_table[i];
+                if (!o.pc)
+                    continue;
+
+                Entry &e = find(o.pc);
+                e.executed += o.executed;
+                e.taken += o.taken;
+                e.mispredicted += o.mispredicted;
+            }
+        }
+
+        size_t size() const { return m_used; }
+
+        // The n branches with the most mispredictions, most first
+        std::vector<Entry> top(size_t n) const
+        {
+            std::vector<Entry> entries;
+            entries.reserve(m_used);
+            for (size_t i = 0; i < m_table.size(); i++)
+                if (m_table[i].pc)
+                    entries.push_back(m_table[i]);
+
+            n = std::min(n, entries.size());
+            std::partial_sort(entries.begin(), entries.begin() + n, entries.end(),
+                [](const Entry &a, const Entry &b) {
+                    return a.mispredicted != b.mispredicted ? a.mispredicted > b.mispredicted : a.pc < b.pc;
+                });
+            entries.resize(n);
+            return entries;
+        }
+};
+
+// Build a predictor from a configuration string "name[:param...]":
+//   bht[:entry_num_log[:scnt_width]]                       (12, 2)
+//   gshare[:ghr_width[:entry_num_log[:scnt_width]]]        (16, 16, 2)
+//   tournament[:bht_log[:ghr_width[:pht_log]]]             (16, 16, 16)
+//   tage[:tnum[:T0_log[:T1ghr_len[:alpha[:Tn_log[:tag_width]]]]]]   (5, 10, 4, 2, 12, 9)
+//   perceptron[:entry_num_log[:ghr_len]]                   (10, 32)
+// The suffixes "+loop" and "+sc" add a loop predictor (WithLoop) and a
+// statistical corrector (WithSC), e.g. "tage+loop+sc". A final suffix
+// "@depth[:batch]" puts the predictor behind a DelayedUpdate queue of depth
+// branches retiring batch at a time (1), e.g. "tage@64:4". The perceptron
+// supports none of the suffixes.
+// Returns NULL for an unknown name or a parameter out of range: table logs
+// up to BP_MAX_ENTRIES_LOG (24 for tage, 20 for perceptron), histories of
+// 1 to BP_MAX_HISTORY outcomes, counters of 2 to 4 bits, tnum 2 to
+// TAGE_MAX_TABLES, alpha 1 to 16, tags of 2 to 16 bits, ghr_len up to 1024
+// and depth up to BP_MAX_DELAY with 1 <= batch <= depth.
+#define BP_MAX_ENTRIES_LOG  30
+#define BP_MAX_HISTORY      4096
+#define BP_MAX_DELAY        4096
+
+inline BranchPredictor* newPredictor(const std::string &config)
+{
+    size_t depth = 0, batch = 1;
+    size_t at = config.find('@');
+    if (at != std::string::npos)
+    {
+        const char* delay = config.c_str() + at + 1;
+        char* end;
+        depth = strtoul(delay, &end, 10);
+        if (*end == ':')
+            batch = strtoul(end + 1, &end, 10);
+        if (end == delay || *end || depth == 0 || depth > BP_MAX_DELAY || batch == 0 || batch > depth)
+            return NULL;
+    }
+
+    // Side predictors
+    bool loop = false, sc = false;
+    std::string base = config.substr(0, at);
+    size_t plus;
+    while ((plus = base.rfind('+')) != std::string::npos)
+    {
+        std::string side = base.substr(plus + 1);
+        if (side == "loop")
+            loop = true;
+        else if (side == "sc")
+            sc = true;
+        else
+            return NULL;
+        base.erase(plus);
+    }
+
+    std::vector<std::string> fields;
+    size_t start = 0, colon;
+    while ((colon = base.find(':', start)) != std::string::npos)
+    {
+        fields.push_back(base.substr(start, colon - start));
+        start = colon + 1;
+    }
+    fields.push_back(base.substr(start));
+
+    // The i-th parameter, or def if it is not given. A parameter that is not
+    // a number in [lo, hi] (an integer unless real) clears ok.
+    bool ok = true;
+    auto param = [&fields, &ok](size_t i, double def, double lo, double hi, bool real = false) {
+        double val = def;
+        if (i < fields.size())
+        {
+            char* end;
+            val = strtod(fields[i].c_str(), &end);
+            if (fields[i].empty() || *end)
+                ok = false;
+        }
+        if (!(val >= lo && val <= hi) || (!real && val != floor(val)))
+            ok = false;
+        return val;
+    };
+
+    // Whether every parameter was valid and there are at most n of them
+    auto valid = [&fields, &ok](size_t n) { return ok && fields.size() <= n + 1; };
+
+    const std::string &name = fields[0];
+    if (name == "bht")
+    {
+        size_t log = param(1, 12, 1, BP_MAX_ENTRIES_LOG), width = param(2, 2, 2, 4);
+        if (!valid(2))
+            return NULL;
+        return compose(new BHTPredictor(log, width), loop, sc, depth, batch);
+    }
+    if (name == "gshare")
+    {
+        size_t ghr = param(1, 16, 1, BP_MAX_HISTORY), log = param(2, 16, 1, BP_MAX_ENTRIES_LOG), width = param(3, 2, 2, 4);
+        if (!valid(3))
+            return NULL;
+        return compose(new GlobalHistoryPredictor<f_xor>(ghr, log, width), loop, sc, depth, batch);
+    }
+    if (name == "tournament")
+    {
+        size_t bht = param(1, 16, 1, BP_MAX_ENTRIES_LOG), ghr = param(2, 16, 1, BP_MAX_HISTORY),
+               log = param(3, 16, 1, BP_MAX_ENTRIES_LOG);
+        if (!valid(3))
+            return NULL;
+        return compose(new Tournament<BHTPredictor, GlobalHistoryPredictor<f_xor> >(new BHTPredictor(bht),
+                                       new GlobalHistoryPredictor<f_xor>(ghr, log)), loop, sc, depth, batch);
+    }
+    if (name == "tage")
+    {
+        size_t tnum = param(1, 5, 2, TAGE_MAX_TABLES), T0 = param(2, 10, 1, BP_MAX_ENTRIES_LOG),
+               T1 = param(3, 4, 1, BP_MAX_HISTORY);
+        double alpha = param(4, 2, 1, 16, true);
+        size_t Tn = param(5, 12, 1, 24), tag = param(6, 9, 2, 16);
+        if (!valid(6))
+            return NULL;
+
+        // The longest history, as TAGEPredictor::historyLength() grows it
+        double len = T1;
+        for (size_t i = 2; i < tnum && len <= BP_MAX_HISTORY; i++)
+            len = std::max((double)floor((float)len * (float)alpha), len + 1);
+        if (len > BP_MAX_HISTORY)
+            return NULL;
+
+        return compose(new TAGEPredictor<f_xor, f_xor1>(tnum, T0, T1, alpha, Tn, tag), loop, sc, depth, batch);
+    }
+    if (name == "perceptron" && depth == 0 && !loop && !sc)
+    {
+        size_t log = param(1, 10, 0, 20), ghr = param(2, 32, 1, 1024);
+        if (!valid(2))
+            return NULL;
+        return new PerceptronPredictor(log, ghr);
+    }
+    return NULL;
+}
+
+#define BP_CHECKPOINT_MAGIC "BPCKPT01"
+#define BP_CHECKPOINT_MAGIC_LEN 8
+#define BP_CHECKPOINT_MAX_NAME  256     // Longest configuration name in a checkpoint
+
+// A set of predictors that all see every branch, each with its own stats.
+// A bank can share the tables of another bank's predictors, e.g. one bank
+// per thread over the same predictor tables.
+class PredictorBank
+{
+    std::vector<std::string> m_names;
+    std::vector<BranchPredictor*> m_BPs;
+    std::vector<BranchStats> m_stats;
+
+    public:
+        ~PredictorBank()
+        {
+            for (size_t i = 0; i < m_BPs.size(); i++)
+                delete m_BPs[i];
+        }
+
+        // Predict over the tables of the predictors of other (see
+        // BranchPredictor::shareTables()), with histories and stats of our
+        // own; other must outlive the bank
+        void share(const PredictorBank &other)
+        {
+            m_names = other.m_names;
+            for (size_t i = 0; i < other.m_BPs.size(); i++)
+                m_BPs.push_back(other.m_BPs[i]->shareTables());
+            m_stats.assign(m_BPs.size(), BranchStats());
+        }
+
+        // Add the stats of other, which has the same configurations
+        void merge(const PredictorBank &other)
+        {
+            for (size_t i = 0; i < m_stats.size() && i < other.m_stats.size(); i++)
+                m_stats[i].merge(other.m_stats[i]);
+        }
+
+        // Take ownership of BP
+        void add(BranchPredictor* BP, const std::string &name)
+        {
+            m_names.push_back(name);
+            m_BPs.push_back(BP);
+            m_stats.push_back(BranchStats());
+        }
+
+        // Add the predictor described by config; false if it is invalid
+        bool add(const std::string &config)
+        {
+            BranchPredictor* BP = newPredictor(config);
+            if (!BP)
+                return false;
+
+            add(BP, config);
+            return true;
+        }
+
+        // Returns the prediction of the first predictor
+        bool predictBranch(ADDRINT addr, bool takenActually)
+        {
+            bool first = false;
+            for (size_t i = 0; i < m_BPs.size(); i++)
+            {
+                bool takenPredicted = m_BPs[i]->access(addr, takenActually);
+                m_stats[i].count(takenPredicted, takenActually);
+                if (i == 0)
+                    first = takenPredicted;
+            }
+            return first;
+        }
+
+        size_t size() const { return m_BPs.size(); }
+        const std::string &name(size_t i) const { return m_names[i]; }
+        BranchPredictor* predictor(size_t i) { return m_BPs[i]; }
+        BranchStats &stats(size_t i) { return m_stats[i]; }
+
+        // Save the state of every predictor: a magic, then per predictor its
+        // name, the size of its state and the state itself
+        bool save(std::ostream &out)
+        {
+            out.write(BP_CHECKPOINT_MAGIC, BP_CHECKPOINT_MAGIC_LEN);
+            for (size_t i = 0; i < m_BPs.size(); i++)
+            {
+                if (m_names[i].size() > BP_CHECKPOINT_MAX_NAME)
+                    return false;
+
+                std::ostringstream state;
+                Checkpoint cp(state);
+                m_BPs[i]->checkpoint(cp);
+
+                std::string blob = state.str();
+                UINT64 len = m_names[i].size(), size = blob.size();
+                out.write((const char*)&len, sizeof(len));
+                out.write(m_names[i].data(), len);
+                out.write((const char*)&size, sizeof(size));
+                out.write(blob.data(), size);
+            }
+            return out.good();
+        }
+
+        // Restore the predictors that have a record of the same name and
+        // size; the others stay cold. Returns the number restored, or -1 if
+        // in is not a checkpoint or is truncated.
+        int load(std::istream &in)
+        {
+            char magic[BP_CHECKPOINT_MAGIC_LEN];
+            if (!in.read(magic, BP_CHECKPOINT_MAGIC_LEN) || memcmp(magic, BP_CHECKPOINT_MAGIC, BP_CHECKPOINT_MAGIC_LEN))
+                return -1;
+
+            int restored = 0;
+            UINT64 len, size;
+            while (in.read((char*)&len, sizeof(len)))
+            {
+                if (len > BP_CHECKPOINT_MAX_NAME)
+                    return -1;
+
+                std::string name(len, '\0');
+                if (!in.read(&name[0], len) || !in.read((char*)&size, sizeof(size)) || (std::streamsize)size < 0)
+                    return -1;
+
+                // The size tells a different configuration under the same name
+                size_t match = m_BPs.size();
+                for (size_t i = 0; i < m_BPs.size() && match == m_BPs.size(); i++)
+                {
+                    if (m_names[i] != name)
+                        continue;
+
+                    std::ostringstream current;
+                    Checkpoint probe(current);
+                    m_BPs[i]->checkpoint(probe);
+                    if (current.str().size() == size)
+                        match = i;
+                }
+
+                // Only a record that fits a predictor is read into memory
+                if (match == m_BPs.size())
+                {
+                    if (!in.ignore(size) || (UINT64)in.gcount() != size)
+                        return -1;
+                    continue;
+                }
+
+                std::string blob(size, '\0');
+                if (!in.read(&blob[0], size))
+                    return -1;
+
+                std::istringstream state(blob);
+                Checkpoint cp(state);
+                m_BPs[match]->checkpoint(cp);
+                restored++;
+            }
+            return restored;
+        }
+
+        // Write the stats of every predictor, each under its configuration
+        void write(std::ostream &out, UINT64 instructions = 0) const
+        {
+            for (size_t i = 0; i < m_BPs.size(); i++)
+            {
+                out << "Predictor: " << m_names[i] << std::endl
+                    << "Storage: " << m_BPs[i]->storageBits() << " bits ("
+                    << m_BPs[i]->storageBits() / 8192.0 << " KB)" << std::endl;
+                m_stats[i].write(out, instructions);
+            }
+        }
+};
+
+#endif // BRCH_PREDICT_H
@@ -0,0 +1,137 @@
+// Offline replay of a branch trace captured with brchPredict -trace.
+//
+// Drives a bank of predictors from the trace without Pin, so predictor
+// experiments do not need to re-run the target program. Every predictor
+// runs on a worker thread of its own over the shared, read-only mapping of
+// the trace. Build with
+//     g++ -O2 -std=c++11 -pthread -DBP_STANDALONE -o brchReplay brchReplay.cpp
+// and run
+//     ./brchReplay [-j threads] [-load ckpt] [-save ckpt] <trace> [config...]
+// where each config is a predictor configuration as accepted by
+// newPredictor() in brchPredict.h (default: bht:12). -load starts the
+// predictors from a checkpoint, -save writes one after the trace, e.g. to
+// warm up the predictors of a sampled brchPredict run (-ckpt_load).
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <sys/time.h>
+#include "brchTrace.h"
+#include "brchPredict.h"
+
+using namespace std;
+
+double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Run predictor i of bank over the whole trace
+void replay(const BranchTraceFile &trace, PredictorBank &bank, size_t i)
+{
+    BranchTraceReader reader(trace.begin(), trace.end());
+    BranchPredictor* BP = bank.predictor(i);
+    BranchStats stats;
+
+    uint64_t pc;
+    bool direction;
+    while (reader.next(pc, direction))
+        stats.count(BP->access(pc, direction), direction);
+
+    bank.stats(i) = stats;
+}
+
+int main(int argc, char * argv[])
+{
+    size_t threads = thread::hardware_concurrency();
+    const char* loadFile = NULL;
+    const char* saveFile = NULL;
+    int arg = 1;
+
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2)
+    {
+        if (!strcmp(argv[arg], "-j"))
+            threads = atoi(argv[arg + 1]);
+        else if (!strcmp(argv[arg], "-load"))
+            loadFile = argv[arg + 1];
+        else if (!strcmp(argv[arg], "-save"))
+            saveFile = argv[arg + 1];
+        else
+            break;
+    }
+
+    if (arg >= argc || threads == 0 || argv[arg][0] == '-')
+    {
+        cerr << "Usage: " << argv[0] << " [-j threads] [-load ckpt] [-save ckpt] <trace> [config...]" << endl;
+        return -1;
+    }
+
+    BranchTraceFile trace;
+    if (!trace.open(argv[arg]))
+    {
+        cerr << "Cannot read branch trace " << argv[arg] << endl;
+        return -1;
+    }
+
+    PredictorBank bank;
+    for (arg++; arg < argc; arg++)
+    {
+        if (!bank.add(argv[arg]))
+        {
+            cerr << "Unknown or invalid predictor " << argv[arg] << endl;
+            return -1;
+        }
+    }
+
+    if (bank.size() == 0)
+        bank.add("bht:12");
+
+    if (loadFile)
+    {
+        ifstream in(loadFile, ios::binary);
+        int restored = bank.load(in);
+        if (restored < 0)
+        {
+            cerr << "Cannot read checkpoint " << loadFile << endl;
+            return -1;
+        }
+        cerr << restored << " of " << bank.size() << " predictors restored from " << loadFile << endl;
+    }
+
+    double start = now();
+
+    // Workers take the predictors one by one
+    atomic<size_t> nextPredictor(0);
+    vector<thread> workers;
+    for (size_t t = 0; t < threads && t < bank.size(); t++)
+    {
+        workers.push_back(thread([&]() {
+            for (size_t i; (i = nextPredictor++) < bank.size(); )
+                replay(trace, bank, i);
+        }));
+    }
+
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+
+    double elapsed = now() - start;
+
+    bank.write(cout);
+
+    if (saveFile)
+    {
+        ofstream out(saveFile, ios::binary);
+        if (!bank.save(out))
+            cerr << "Cannot write checkpoint " << saveFile << endl;
+    }
+
+    UINT64 total = bank.stats(0).total() * bank.size();
+    cerr << total << " branch predictions in " << elapsed << " s ("
+        << total / elapsed / 1e6 << " M/s on " << workers.size() << " threads)" << endl;
+
+    return 0;
+}
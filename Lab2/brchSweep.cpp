@@ -0,0 +1,226 @@
+// Design space exploration of branch predictors under a storage budget.
+//
+// Enumerates predictor configurations (see newPredictor() in brchPredict.h)
+// with their tables scaled up until storageBits() reaches the budget,
+// replays a trace captured with brchPredict -trace through each of them on
+// a pool of worker threads and prints every point as CSV, sorted by size,
+// with the points of the Pareto frontier of MPKI vs. KB marked. Build with
+//     g++ -O2 -std=c++11 -pthread -DBP_STANDALONE -o brchSweep brchSweep.cpp
+// and run
+//     ./brchSweep [-j threads] [-i instructions] <trace> <budget KB> [config...]
+// Extra configs are evaluated along with the enumerated ones if they fit
+// into the budget. The trace
+// holds no instruction count: pass the one brchPredict reported with -i to
+// get MPKI, otherwise the misses are given per 1000 branches.
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <sys/time.h>
+#include "brchTrace.h"
+#include "brchPredict.h"
+
+using namespace std;
+
+struct Point
+{
+    string config;
+    UINT64 bits;
+    BranchStats stats;
+};
+
+double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Add config(log) for log = lo, lo + 1, ... as long as it fits into the
+// budget. The storage grows with the table log, so the first configuration
+// over the budget ends the family.
+template<class F>
+void grow(vector<string> &configs, UINT64 budget, int lo, int hi, F config)
+{
+    for (int log = lo; log <= hi; log++)
+    {
+        string c = config(log);
+        BranchPredictor* BP = newPredictor(c);
+        UINT64 bits = BP ? BP->storageBits() : ~0ULL;
+        delete BP;
+
+        if (bits > budget)
+            break;
+        configs.push_back(c);
+    }
+}
+
+// The configurations of every predictor family: the shape parameters
+// (counter widths, history lengths, number of tables) are fixed lists, the
+// table sizes are scaled up until the budget is used
+vector<string> enumerate(UINT64 budget)
+{
+    vector<string> configs;
+
+#define CONFIG(x) [&](int log) { ostringstream c; c << x; return c.str(); }
+
+    for (int width = 2; width <= 3; width++)
+        grow(configs, budget, 4, BP_MAX_ENTRIES_LOG, CONFIG("bht:" << log << ":" << width));
+
+    static const int ghrs[] = { 4, 8, 12, 16, 24, 32, 48, 64 };
+    for (size_t h = 0; h < sizeof(ghrs) / sizeof(ghrs[0]); h++)
+        grow(configs, budget, 6, BP_MAX_ENTRIES_LOG, CONFIG("gshare:" << ghrs[h] << ":" << log));
+
+    grow(configs, budget, 6, BP_MAX_ENTRIES_LOG, CONFIG("tournament:" << log << ":" << log << ":" << log));
+    grow(configs, budget, 6, BP_MAX_ENTRIES_LOG, CONFIG("tournament:" << log - 2 << ":" << log << ":" << log));
+
+    // Tn scales; T0 is as large as Tn or 2 logs larger
+    static const int tnums[] = { 5, 7, 9 };
+    for (size_t t = 0; t < sizeof(tnums) / sizeof(tnums[0]); t++)
+        for (int T0 = 0; T0 <= 2; T0 += 2)
+            for (int tag = 9; tag <= 11; tag += 2)
+                grow(configs, budget, 6, 24, CONFIG("tage:" << tnums[t] << ":" << log + T0 << ":4:2:" << log << ":" << tag));
+
+    // Side predictors on the larger base predictors
+    grow(configs, budget, 6, BP_MAX_ENTRIES_LOG, CONFIG("tournament:" << log << ":" << log << ":" << log << "+loop"));
+    for (size_t t = 0; t < sizeof(tnums) / sizeof(tnums[0]); t++)
+    {
+        grow(configs, budget, 6, 24, CONFIG("tage:" << tnums[t] << ":" << log + 2 << ":4:2:" << log << ":11+loop"));
+        grow(configs, budget, 6, 24, CONFIG("tage:" << tnums[t] << ":" << log + 2 << ":4:2:" << log << ":11+loop+sc"));
+    }
+
+    // The same TAGE updated late, to price a deep pipeline in accuracy
+    static const int depths[] = { 8, 32 };
+    for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++)
+        grow(configs, budget, 6, 24, CONFIG("tage:7:" << log + 2 << ":4:2:" << log << ":11+loop+sc@" << depths[d]));
+
+    static const int lens[] = { 12, 24, 32, 48, 64 };
+    for (size_t h = 0; h < sizeof(lens) / sizeof(lens[0]); h++)
+        grow(configs, budget, 4, 20, CONFIG("perceptron:" << log << ":" << lens[h]));
+
+#undef CONFIG
+    return configs;
+}
+
+// Replay the whole trace through the predictor of p
+void evaluate(const BranchTraceFile &trace, Point &p)
+{
+    BranchTraceReader reader(trace.begin(), trace.end());
+    BranchPredictor* BP = newPredictor(p.config);
+
+    uint64_t pc;
+    bool direction;
+    while (reader.next(pc, direction))
+        p.stats.count(BP->access(pc, direction), direction);
+
+    delete BP;
+}
+
+int main(int argc, char * argv[])
+{
+    size_t threads = thread::hardware_concurrency();
+    UINT64 instructions = 0;
+    int arg = 1;
+
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2)
+    {
+        if (!strcmp(argv[arg], "-j"))
+            threads = atoi(argv[arg + 1]);
+        else if (!strcmp(argv[arg], "-i"))
+            instructions = strtoull(argv[arg + 1], NULL, 10);
+        else
+            break;
+    }
+
+    if (arg + 1 >= argc || threads == 0 || argv[arg][0] == '-')
+    {
+        cerr << "Usage: " << argv[0] << " [-j threads] [-i instructions] <trace> <budget KB> [config...]" << endl;
+        return -1;
+    }
+
+    BranchTraceFile trace;
+    if (!trace.open(argv[arg]))
+    {
+        cerr << "Cannot read branch trace " << argv[arg] << endl;
+        return -1;
+    }
+
+    UINT64 budget = (UINT64)(strtod(argv[arg + 1], NULL) * 8192);
+
+    vector<string> configs = enumerate(budget);
+    for (arg += 2; arg < argc; arg++)
+        configs.push_back(argv[arg]);
+
+    // Size every configuration; only those within the budget are replayed
+    vector<Point> points;
+    for (size_t i = 0; i < configs.size(); i++)
+    {
+        BranchPredictor* BP = newPredictor(configs[i]);
+        if (!BP)
+        {
+            cerr << "Unknown or invalid predictor " << configs[i] << endl;
+            return -1;
+        }
+
+        Point p;
+        p.config = configs[i];
+        p.bits = BP->storageBits();
+        delete BP;
+
+        if (p.bits <= budget)
+            points.push_back(p);
+    }
+
+    cerr << points.size() << " of " << configs.size() << " configurations fit into "
+        << budget / 8192.0 << " KB" << endl;
+
+    double start = now();
+
+    atomic<size_t> nextPoint(0);
+    vector<thread> workers;
+    for (size_t t = 0; t < threads && t < points.size(); t++)
+    {
+        workers.push_back(thread([&]() {
+            for (size_t i; (i = nextPoint++) < points.size(); )
+                evaluate(trace, points[i]);
+        }));
+    }
+
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+
+    cerr << "Evaluated in " << now() - start << " s on " << workers.size() << " threads" << endl;
+
+    sort(points.begin(), points.end(), [](const Point &a, const Point &b) {
+        if (a.bits != b.bits)
+            return a.bits < b.bits;
+        return a.stats.mispredicted() < b.stats.mispredicted();
+    });
+
+    // A point is on the frontier if no smaller one misses as much or less
+    // and no one of the same size misses less. Points of the same size and
+    // MPKI tie: all of them are marked.
+    cout << "config,bits,KB,precision," << (instructions ? "mpki" : "mpkb") << ",pareto" << endl;
+    double best = 1e300;
+    UINT64 bestBits = 0;
+    for (size_t i = 0; i < points.size(); i++)
+    {
+        const Point &p = points[i];
+        double mpk = 1000 * double(p.stats.mispredicted()) / (instructions ? instructions : p.stats.total());
+
+        bool pareto = mpk < best || (mpk == best && p.bits == bestBits);
+        if (pareto)
+        {
+            best = mpk;
+            bestBits = p.bits;
+        }
+
+        cout << p.config << "," << p.bits << "," << p.bits / 8192.0 << ","
+            << p.stats.precision() << "," << mpk << "," << pareto << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,190 @@
+// Compact binary trace of conditional branch outcomes.
+//
+// A trace starts with the 8-byte magic "BRTRACE1", followed by one record per
+// dynamic branch: the PC delta to the previous record, zigzag-encoded, shifted
+// left by one with the direction in bit 0, written as a LEB128 varint. Loops
+// and nearby branches have small deltas, so most records take 1-2 bytes.
+// The delta has to fit in 62 bits, which holds for user-space addresses.
+//
+// Include this header before brchPredict.h: its truncate macro clashes with
+// the truncate() declared by unistd.h.
+#ifndef BRCH_TRACE_H
+#define BRCH_TRACE_H
+
+#include <stdint.h>
+#include <cstring>
+#include <fstream>
+
+#ifdef BP_STANDALONE
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define BRCH_TRACE_MAGIC "BRTRACE1"
+#define BRCH_TRACE_MAGIC_LEN 8
+
+// Buffered trace writer used by the capture mode of brchPredict
+class BranchTraceWriter
+{
+    static const size_t BUF_SIZE = 64 * 1024;
+
+    std::ofstream m_out;
+    char m_buf[BUF_SIZE];
+    size_t m_len;
+    uint64_t m_pc;              // PC of the previous record
+    uint64_t m_count;           // Number of records written
+
+    public:
+        BranchTraceWriter() : m_len(0), m_pc(0), m_count(0) {}
+        ~BranchTraceWriter() { close(); }
+
+        bool open(const char* name)
+        {
+            m_out.open(name, std::ios::binary);
+            if (!m_out)
+                return false;
+
+            m_out.write(BRCH_TRACE_MAGIC, BRCH_TRACE_MAGIC_LEN);
+            return true;
+        }
+
+        void record(uint64_t pc, bool taken)
+        {
+            // A record takes at most 10 bytes
+            if (m_len > BUF_SIZE - 10)
+                flush();
+
+            int64_t delta = (int64_t)(pc - m_pc);
+            uint64_t v = ((((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63)) << 1) | taken;
+            m_pc = pc;
+            m_count++;
+
+            while (v >= 0x80)
+            {
+                m_buf[m_len++] = (char)(v | 0x80);
+                v >>= 7;
+            }
+            m_buf[m_len++] = (char)v;
+        }
+
+        void flush()
+        {
+            m_out.write(m_buf, m_len);
+            m_len = 0;
+        }
+
+        void close()
+        {
+            if (!m_out.is_open())
+                return;
+
+            flush();
+            m_out.close();
+        }
+
+        uint64_t count() { return m_count; }
+};
+
+#ifdef BP_STANDALONE
+// Read-only memory mapping of a whole trace, shared by any number of readers
+class BranchTraceFile
+{
+    const uint8_t* m_begin;
+    size_t m_size;
+
+    public:
+        BranchTraceFile() : m_begin(NULL), m_size(0) {}
+        ~BranchTraceFile() { close(); }
+
+        // Map the trace; false if it cannot be read or is not a branch trace
+        bool open(const char* name)
+        {
+            int fd = ::open(name, O_RDONLY);
+            if (fd < 0)
+                return false;
+
+            struct stat st;
+            if (fstat(fd, &st) < 0 || st.st_size < BRCH_TRACE_MAGIC_LEN)
+            {
+                ::close(fd);
+                return false;
+            }
+
+            m_size = st.st_size;
+            void* p = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (p == MAP_FAILED)
+                return false;
+
+            madvise(p, m_size, MADV_SEQUENTIAL);
+            m_begin = (const uint8_t*)p;
+
+            if (memcmp(m_begin, BRCH_TRACE_MAGIC, BRCH_TRACE_MAGIC_LEN))
+            {
+                close();
+                return false;
+            }
+            return true;
+        }
+
+        void close()
+        {
+            if (m_begin)
+                munmap((void*)m_begin, m_size);
+            m_begin = NULL;
+            m_size = 0;
+        }
+
+        const uint8_t* begin() const { return m_begin + BRCH_TRACE_MAGIC_LEN; }
+        const uint8_t* end() const { return m_begin + m_size; }
+};
+#endif // BP_STANDALONE
+
+// Sequential decoder of the records in [begin, end)
+class BranchTraceReader
+{
+    const uint8_t* m_begin;
+    const uint8_t* m_cur;
+    const uint8_t* m_end;
+    uint64_t m_pc;              // PC of the previous record
+
+    public:
+        BranchTraceReader(const uint8_t* begin, const uint8_t* end)
+            : m_begin(begin), m_cur(begin), m_end(end), m_pc(0) {}
+
+        void rewind()
+        {
+            m_cur = m_begin;
+            m_pc = 0;
+        }
+
+        // Decode the next record; false at the end of the trace
+        bool next(uint64_t &pc, bool &taken)
+        {
+            uint64_t v = 0;
+            int shift = 0;
+
+            for (;;)
+            {
+                // A truncated last record ends the trace
+                if (m_cur == m_end)
+                    return false;
+
+                uint8_t b = *m_cur++;
+                v |= (uint64_t)(b & 0x7f) << shift;
+                if (!(b & 0x80))
+                    break;
+                shift += 7;
+            }
+
+            taken = v & 1;
+            v >>= 1;
+            m_pc += (v >> 1) ^ (0 - (v & 1));
+            pc = m_pc;
+            return true;
+        }
+};
+
+#endif // BRCH_TRACE_H
@@ -0,0 +1,407 @@
+// Branch target prediction: a set-associative BTB for all taken branches,
+// an ITTAGE-style predictor for indirect jumps and calls and a return
+// address stack. Every predictor returns the target it predicts, 0 when it
+// has none.
+// With BP_STANDALONE defined the header does not need Pin (see brchPredict.h).
+#ifndef TARGET_PREDICT_H
+#define TARGET_PREDICT_H
+
+#include <vector>
+#include <ostream>
+#include "brchPredict.h"
+
+// Outcome counters of one target predictor
+struct TargetStats
+{
+    UINT64 lookups;
+    UINT64 hits;                    // Lookups that produced a target
+    UINT64 correct;                 // Lookups that produced the right target
+
+    TargetStats() : lookups(0), hits(0), correct(0) {}
+
+    void count(ADDRINT targetPredicted, ADDRINT targetActually)
+    {
+        lookups++;
+        hits += targetPredicted != 0;
+        correct += targetPredicted == targetActually;
+    }
+
+    void merge(const TargetStats &other)
+    {
+        lookups += other.lookups;
+        hits += other.hits;
+        correct += other.correct;
+    }
+
+    void write(std::ostream &out) const
+    {
+        out << "lookups: " << lookups << std::endl
+            << "hits: " << hits << std::endl
+            << "correct: " << correct << std::endl
+            << "Hit rate: " << (lookups ? 100 * double(hits) / lookups : 0) << std::endl
+            << "Precision: " << (lookups ? 100 * double(correct) / lookups : 0) << std::endl;
+    }
+};
+
+/* ===================================================================== */
+/* Branch Target Buffer                                                  */
+/* ===================================================================== */
+
+// Set-associative BTB with LRU replacement. The entries are tagged with the
+// full PC, i.e. there is no aliasing between branches of the same set.
+class BTB
+{
+    struct Entry
+    {
+        ADDRINT pc;                 // 0: invalid
+        ADDRINT target;
+        UINT64 lastUse;             // LRU timestamp
+    };
+
+    size_t m_sets_log;
+    size_t m_ways;
+    Entry* m_entries;
+    UINT64 m_clock;
+
+    Entry* set(ADDRINT pc) { return m_entries + truncate(pc ^ (pc >> m_sets_log), m_sets_log) * m_ways; }
+
+    public:
+        BTB(size_t sets_log, size_t ways)
+            : m_sets_log(sets_log), m_ways(ways ? ways : 1), m_clock(0)
+        {
+            m_entries = new Entry[m_ways << m_sets_log];
+            memset(m_entries, 0, sizeof(Entry) * (m_ways << m_sets_log));
+        }
+
+        ~BTB() { delete[] m_entries; }
+
+        ADDRINT lookup(ADDRINT pc)
+        {
+            Entry* s = set(pc);
+            for (size_t w = 0; w < m_ways; w++)
+            {
+                if (s[w].pc == pc)
+                {
+                    s[w].lastUse = ++m_clock;
+                    return s[w].target;
+                }
+            }
+            return 0;
+        }
+
+        // Install or refresh the target of pc, evicting the LRU way
+        void update(ADDRINT pc, ADDRINT target)
+        {
+            Entry* s = set(pc);
+            Entry* victim = s;
+            for (size_t w = 0; w < m_ways; w++)
+            {
+                if (s[w].pc == pc)
+                {
+                    victim = s + w;
+                    break;
+                }
+                if (s[w].lastUse < victim->lastUse)
+                    victim = s + w;
+            }
+
+            victim->pc = pc;
+            victim->target = target;
+            victim->lastUse = ++m_clock;
+        }
+
+        ADDRINT access(ADDRINT pc, ADDRINT target)
+        {
+            ADDRINT predicted = lookup(pc);
+            if (predicted != target)
+                update(pc, target);
+            return predicted;
+        }
+
+        // Full-PC tag, target and the LRU position of every entry
+        UINT64 storageBits() const
+        {
+            return (UINT64)(m_ways << m_sets_log) * (2 * sizeof(ADDRINT) * 8 + counterBits(m_ways));
+        }
+};
+
+/* ===================================================================== */
+/* Return Address Stack                                                  */
+/* ===================================================================== */
+
+// Circular return address stack: a call beyond the depth overwrites the
+// oldest entry, a return on the empty stack predicts nothing
+class ReturnStack
+{
+    std::vector<ADDRINT> m_stack;
+    size_t m_top;
+    size_t m_count;
+
+    public:
+        ReturnStack(size_t depth = 16) : m_stack(depth ? depth : 1, 0), m_top(0), m_count(0) {}
+
+        void push(ADDRINT returnAddr)
+        {
+            m_top = (m_top + 1) % m_stack.size();
+            m_stack[m_top] = returnAddr;
+            if (m_count < m_stack.size())
+                m_count++;
+        }
+
+        ADDRINT pop()
+        {
+            if (m_count == 0)
+                return 0;
+
+            ADDRINT returnAddr = m_stack[m_top];
+            m_top = (m_top + m_stack.size() - 1) % m_stack.size();
+            m_count--;
+            return returnAddr;
+        }
+
+        // One return address per entry
+        UINT64 storageBits() const { return (UINT64)m_stack.size() * sizeof(ADDRINT) * 8; }
+};
+
+/* ===================================================================== */
+/* Indirect Target TAGE                                                  */
+/* ===================================================================== */
+
+#define ITTAGE_MAX_TABLES 16
+
+// Context of an ITTAGE lookup
+struct ITTAGECtx
+{
+    UINT32 base;                        // Index into the base table
+    UINT32 idx[ITTAGE_MAX_TABLES];      // Index into every tagged table
+    UINT16 tag[ITTAGE_MAX_TABLES];      // Partial tag for every tagged table
+    int provider;                       // Longest hitting table (0: base table)
+    int altpred;                        // Next longest hitting table (0: base table)
+    ADDRINT providerTarget;
+    ADDRINT altTarget;
+    ADDRINT pred;                       // Final prediction
+};
+
+// ITTAGE: TAGE with targets instead of direction counters. The base table
+// T0 holds the last target per PC; the tagged tables T[1 : tnum - 1],
+// indexed with geometrically longer global histories, hold a target with a
+// 2-bit confidence and a 2-bit useful counter. The history gets the
+// direction of every conditional branch (pushHistory) and two bits of
+// every indirect target.
+class ITTAGEPredictor
+{
+    const size_t m_tnum;
+    const size_t m_base_log;
+    const size_t m_entries_log;
+    const size_t m_tag_width;
+
+    ADDRINT* m_base;                    // Last target of T0
+    ADDRINT* m_target;                  // Targets of T[1 : m_tnum - 1]
+    UINT16* m_tag;                      // Partial tags of T[1 : m_tnum - 1]
+    bool m_own;                         // Whether the tables are ours or another predictor's
+    PackedCounters<2> m_conf;           // Confidence in the target
+    PackedCounters<2> m_useful;         // Useful counters
+
+    GlobalHistory m_hist;
+    size_t m_fold_idx[ITTAGE_MAX_TABLES];
+    size_t m_fold_tag[ITTAGE_MAX_TABLES];
+
+    UINT32 m_seed;                      // Pseudo-random allocation choice
+    const size_t m_rst_period;          // Aging period of the useful counters
+    size_t m_rst_cnt;
+
+    static size_t historyLength(size_t i, size_t T1ghr_len, float alpha)
+    {
+        size_t len = T1ghr_len;
+        for (size_t k = 1; k < i; k++)
+            len = (size_t)(len * alpha) > len ? (size_t)(len * alpha) : len + 1;
+        return len;
+    }
+
+    public:
+        typedef ITTAGECtx Ctx;
+
+        // Constructor
+        // param:   tnum:               The number of tables (at most ITTAGE_MAX_TABLES)
+        //          T0_entry_num_log:   Log2 of the entries of the base table
+        //          T1ghr_len:          History length of T1
+        //          alpha:              Ratio of the history lengths of T[i + 1] and T[i]
+        //          Tn_entry_num_log:   Log2 of the entries of each tagged table
+        //          tag_width:          Width of the partial tags (at most 16)
+        //          rst_period:         Aging period of the useful counters
+        ITTAGEPredictor(size_t tnum = 8, size_t T0_entry_num_log = 10, size_t T1ghr_len = 4, float alpha = 2,
+                        size_t Tn_entry_num_log = 9, size_t tag_width = 11, size_t rst_period = 256*1024)
+        : m_tnum(tnum < 2 ? 2 : tnum < ITTAGE_MAX_TABLES ? tnum : ITTAGE_MAX_TABLES),
+          m_base_log(T0_entry_num_log), m_entries_log(Tn_entry_num_log),
+          m_tag_width(tag_width < 2 ? 2 : tag_width > 16 ? 16 : tag_width), m_own(true),
+          m_conf((m_tnum - 1) << Tn_entry_num_log, 0), m_useful((m_tnum - 1) << Tn_entry_num_log, 0),
+          m_hist(historyLength(m_tnum - 1, T1ghr_len, alpha)),
+          m_seed(0x2545f491), m_rst_period(rst_period), m_rst_cnt(0)
+        {
+            size_t n = (m_tnum - 1) << m_entries_log;
+            m_base = new ADDRINT[(size_t)1 << m_base_log];
+            m_target = new ADDRINT[n];
+            m_tag = new UINT16[n];
+            memset(m_base, 0, sizeof(ADDRINT) << m_base_log);
+            memset(m_target, 0, sizeof(ADDRINT) * n);
+            memset(m_tag, 0, sizeof(UINT16) * n);
+
+            for (size_t i = 1; i < m_tnum; i++)
+            {
+                size_t len = historyLength(i, T1ghr_len, alpha);
+                m_fold_idx[i] = m_hist.fold(len, m_entries_log);
+                m_fold_tag[i] = m_hist.fold(len, m_tag_width);
+            }
+        }
+
+        // The tables of other, with copies of its history, allocation LFSR
+        // and aging counter (see BranchPredictor::shareTables())
+        ITTAGEPredictor(ITTAGEPredictor &other, ShareTables)
+        : m_tnum(other.m_tnum), m_base_log(other.m_base_log), m_entries_log(other.m_entries_log),
+          m_tag_width(other.m_tag_width), m_base(other.m_base), m_target(other.m_target), m_tag(other.m_tag),
+          m_own(false), m_conf(other.m_conf, SHARE_TABLES), m_useful(other.m_useful, SHARE_TABLES),
+          m_hist(other.m_hist), m_seed(other.m_seed), m_rst_period(other.m_rst_period), m_rst_cnt(other.m_rst_cnt)
+        {
+            memcpy(m_fold_idx, other.m_fold_idx, sizeof(m_fold_idx));
+            memcpy(m_fold_tag, other.m_fold_tag, sizeof(m_fold_tag));
+        }
+
+        ~ITTAGEPredictor()
+        {
+            if (!m_own)
+                return;
+
+            delete[] m_base;
+            delete[] m_target;
+            delete[] m_tag;
+        }
+
+        // Record the direction of a conditional branch
+        void pushHistory(bool taken) { m_hist.push(taken); }
+
+        ADDRINT lookup(ADDRINT addr, Ctx &ctx)
+        {
+            ctx.provider = 0;
+            ctx.altpred = 0;
+            ctx.base = truncate(addr ^ (addr >> m_base_log), m_base_log);
+
+            for (size_t i = 1; i < m_tnum; i++)
+            {
+                UINT64 fold_idx = m_hist.folded(m_fold_idx[i]);
+                ctx.idx[i] = ((i - 1) << m_entries_log)
+                    | truncate(addr ^ (addr >> m_entries_log) ^ fold_idx, m_entries_log);
+                ctx.tag[i] = truncate(addr ^ m_hist.folded(m_fold_tag[i]) ^ (fold_idx << 1), m_tag_width);
+
+                if (m_tag[ctx.idx[i]] == ctx.tag[i])
+                {
+                    ctx.altpred = ctx.provider;
+                    ctx.provider = i;
+                }
+            }
+
+            ctx.altTarget = ctx.altpred ? m_target[ctx.idx[ctx.altpred]] : m_base[ctx.base];
+            if (ctx.provider == 0)
+                return ctx.pred = ctx.providerTarget = ctx.altTarget;
+
+            // Fall back to altpred while the provider has no confidence
+            UINT32 p = ctx.idx[ctx.provider];
+            ctx.providerTarget = m_target[p];
+            ctx.pred = m_conf.get(p) == 0 && ctx.altTarget ? ctx.altTarget : ctx.providerTarget;
+            return ctx.pred;
+        }
+
+        void train(const Ctx &ctx, ADDRINT target)
+        {
+            if (++m_rst_cnt == m_rst_period)
+            {
+                m_useful.age();
+                m_rst_cnt = 0;
+            }
+
+            // Allocate an entry in a longer table on a misprediction
+            if (ctx.pred != target && ctx.provider < (int)m_tnum - 1)
+            {
+                int first = -1, count = 0;
+                for (size_t i = ctx.provider + 1; i < m_tnum; i++)
+                {
+                    if (m_useful.get(ctx.idx[i]) == 0)
+                    {
+                        if (first < 0)
+                            first = i;
+                        count++;
+                    }
+                }
+
+                if (first < 0)
+                {
+                    for (size_t i = ctx.provider + 1; i < m_tnum; i++)
+                        m_useful.decrease(ctx.idx[i]);
+                }
+                else
+                {
+                    m_seed ^= m_seed << 13;
+                    m_seed ^= m_seed >> 17;
+                    m_seed ^= m_seed << 5;
+
+                    size_t i = first;
+                    if (count > 1 && (m_seed & 1))
+                    {
+                        for (i = first + 1; m_useful.get(ctx.idx[i]) != 0; i++)
+                            ;
+                    }
+
+                    m_tag[ctx.idx[i]] = ctx.tag[i];
+                    m_target[ctx.idx[i]] = target;
+                    m_conf.set(ctx.idx[i], 0);
+                }
+            }
+
+            if (ctx.provider == 0)
+            {
+                m_base[ctx.base] = target;
+            }
+            else
+            {
+                // A confident target is only replaced once its confidence is gone
+                UINT32 p = ctx.idx[ctx.provider];
+                if (ctx.providerTarget == target)
+                    m_conf.increase(p);
+                else if (m_conf.get(p) > 0)
+                    m_conf.decrease(p);
+                else
+                    m_target[p] = target;
+
+                if (ctx.providerTarget != ctx.altTarget)
+                {
+                    if (ctx.providerTarget == target)
+                        m_useful.increase(p);
+                    else
+                        m_useful.decrease(p);
+                }
+            }
+
+            ADDRINT bits = target ^ (target >> 2);
+            m_hist.push(bits & 1);
+            m_hist.push(bits & 2);
+        }
+
+        ADDRINT access(ADDRINT addr, ADDRINT target)
+        {
+            Ctx ctx;
+            ADDRINT predicted = lookup(addr, ctx);
+            train(ctx, target);
+            return predicted;
+        }
+
+        // Base targets; tag, target, confidence and useful bits of the tagged
+        // entries; history, allocation LFSR and aging counter
+        UINT64 storageBits() const
+        {
+            return ((UINT64)sizeof(ADDRINT) * 8 << m_base_log)
+                + (UINT64)(m_tag_width + sizeof(ADDRINT) * 8) * ((m_tnum - 1) << m_entries_log)
+                + m_conf.storageBits() + m_useful.storageBits() + m_hist.storageBits()
+                + 32 + counterBits(m_rst_period);
+        }
+};
+
+#endif // TARGET_PREDICT_H
@@ -0,0 +1,623 @@
+// Cache models: fully associative and set-associative caches with LRU
+// replacement, plus VIVT/PIPT/VIPT variants over a toy page mapping.
+#ifndef CACHE_MODEL_H
+#define CACHE_MODEL_H
+
+#include <cstdio>
+#include <cmath>
+#include "pin.H"
+
+typedef unsigned int UINT32;
+typedef unsigned long int UINT64;
+
+#define PAGE_SIZE_LOG 12
+#define PHY_MEM_SIZE_LOG 30
+
+#define get_vir_page_no(virtual_addr) (virtual_addr >> PAGE_SIZE_LOG)
+#define get_page_offset(addr) (addr & ((1u << PAGE_SIZE_LOG) - 1))
+
+// Obtain physical page number according to a given virtual page number
+inline UINT32 get_phy_page_no(UINT32 virtual_page_no)
+{
+    UINT32 vpn = virtual_page_no;
+    vpn = (~vpn ^ (vpn << 16)) + (vpn & (vpn << 16)) + (~vpn | (vpn << 2));
+
+    UINT32 mask = (UINT32)(~0) << (32 - PHY_MEM_SIZE_LOG);
+    mask = mask >> (32 - PHY_MEM_SIZE_LOG + PAGE_SIZE_LOG);
+    mask = mask << PAGE_SIZE_LOG;
+
+    return vpn & mask;
+}
+
+// Transform a virtual address into a physical address
+inline UINT32 get_phy_addr(UINT32 virtual_addr)
+{
+    return (get_phy_page_no(get_vir_page_no(virtual_addr)) << PAGE_SIZE_LOG) + get_page_offset(virtual_addr);
+}
+
+/**************************************
+ * Cache Model Base Class
+ **************************************/
+class CacheModel {
+public:
+    // Constructor
+    CacheModel(UINT32 block_num, UINT32 log_block_size)
+        : m_block_num(block_num)
+        , m_blksz_log(log_block_size)
+        , m_rd_reqs(0)
+        , m_wr_reqs(0)
+        , m_rd_hits(0)
+        , m_wr_hits(0)
+    {
+        m_valids = new bool[m_block_num];
+        m_tags = new UINT32[m_block_num];
+        m_replace_q = new UINT32[m_block_num];
+
+        for (UINT i = 0; i < m_block_num; i++) {
+            m_valids[i] = false;
+            m_replace_q[i] = i;
+        }
+    }
+
+    // Destructor
+    virtual ~CacheModel()
+    {
+        delete[] m_valids;
+        delete[] m_tags;
+        delete[] m_replace_q;
+    }
+
+    // Update the cache state whenever data is read
+    void readReq(UINT32 mem_addr)
+    {
+        m_rd_reqs++;
+        if (access(mem_addr))
+            m_rd_hits++;
+    }
+
+    // Update the cache state whenever data is written
+    void writeReq(UINT32 mem_addr)
+    {
+        m_wr_reqs++;
+        if (access(mem_addr))
+            m_wr_hits++;
+    }
+
+    // Add the requests and hits counted by another cache of the same kind
+    void merge(const CacheModel& other)
+    {
+        m_rd_reqs += other.m_rd_reqs;
+        m_wr_reqs += other.m_wr_reqs;
+        m_rd_hits += other.m_rd_hits;
+        m_wr_hits += other.m_wr_hits;
+    }
+
+    UINT32 getRdReq() { return m_rd_reqs; }
+    UINT32 getWrReq() { return m_wr_reqs; }
+
+    void dumpResults()
+    {
+        float rdHitRate = 100 * (float)m_rd_hits / m_rd_reqs;
+        float wrHitRate = 100 * (float)m_wr_hits / m_wr_reqs;
+        printf("\tread req: %lu,\thit: %lu,\thit rate: %.2f%%\n", m_rd_reqs, m_rd_hits, rdHitRate);
+        printf("\twrite req: %lu,\thit: %lu,\thit rate: %.2f%%\n", m_wr_reqs, m_wr_hits, wrHitRate);
+    }
+
+protected:
+    UINT32 m_block_num; // The number of cache blocks
+    UINT32 m_blksz_log; // 块大小的对数
+
+    bool* m_valids;
+    UINT32* m_tags;
+    UINT32* m_replace_q; // Cache块替换的候选队列
+
+    UINT64 m_rd_reqs; // The number of read-requests
+    UINT64 m_wr_reqs; // The number of write-requests
+    UINT64 m_rd_hits; // The number of hit read-requests
+    UINT64 m_wr_hits; // The number of hit write-requests
+
+    // Look up the cache to decide whether the access is hit or missed
+    virtual bool lookup(UINT32 mem_addr, UINT32& blk_id) = 0;
+
+    // Access the cache: update m_replace_q if hit, otherwise replace a block and update m_replace_q
+    virtual bool access(UINT32 mem_addr) = 0;
+
+    // Update m_replace_q
+    virtual void updateReplaceQ(UINT32 blk_id) = 0;
+};
+
+/**************************************
+ * Fully Associative Cache Class
+ **************************************/
+class FullAssoCache : public CacheModel {
+public:
+    // Constructor
+    FullAssoCache(UINT32 block_num, UINT32 log_block_size)
+        : CacheModel(block_num, log_block_size)
+    {
+    }
+
+    // Destructor
+    ~FullAssoCache() { }
+
+private:
+    UINT32 getTag(UINT32 addr)
+    {
+        return addr >> m_blksz_log;
+    }
+
+    // Look up the cache to decide whether the access is hit or missed
+    bool lookup(UINT32 mem_addr, UINT32& blk_id)
+    {
+        UINT32 tag = getTag(mem_addr);
+
+        for (UINT32 i = 0; i < m_block_num; i++) {
+            if (m_tags[i] == tag) {
+                blk_id = i;
+
+                return m_valids[i];
+            }
+        }
+
+        return false;
+    }
+
+    // Access the cache: update m_replace_q if hit, otherwise replace a block and update m_replace_q
+    bool access(UINT32 mem_addr)
+    {
+        UINT32 blk_id;
+        if (lookup(mem_addr, blk_id)) {
+            updateReplaceQ(blk_id); // Update m_replace_q
+            return true;
+        }
+
+        // Get the to-be-replaced block id using m_replace_q
+        UINT32 bid_2be_replaced = m_replace_q[0];
+        // Replace the cache block
+        m_tags[bid_2be_replaced] = getTag(mem_addr);
+        m_valids[bid_2be_replaced] = true;
+
+        updateReplaceQ(bid_2be_replaced);
+
+        return false;
+    }
+
+    // Update m_replace_q
+    void updateReplaceQ(UINT32 blk_id)
+    {
+        for (UINT32 i = 0; i < m_block_num; i++) {
+            if (m_replace_q[i] == blk_id) {
+                // 前移序列
+                for (UINT32 j = i + 1; j < m_block_num; j++) {
+                    m_replace_q[j - 1] = m_replace_q[j];
+                }
+                m_replace_q[m_block_num - 1] = blk_id;
+
+                break;
+            }
+        }
+    }
+};
+
+/**************************************
+ * Set-Associative Cache Class
+ **************************************/
+class SetAssoCache : public CacheModel {
+public:
+    // Constructor
+    SetAssoCache(UINT32 set_log, UINT32 block_size_log, UINT32 set_block_num)
+        : CacheModel(pow(2.0, set_log) * set_block_num, block_size_log)
+    {
+        this->m_set_block_num = set_block_num;
+        this->m_set_log = set_log;
+    }
+
+    // Destructor
+    ~SetAssoCache() { }
+
+private:
+    UINT32 m_set_block_num;
+    UINT32 m_set_log;
+
+    UINT32 getTag(UINT32 addr)
+    {
+        return addr >> (m_set_log + m_blksz_log);
+    }
+
+    UINT32 getSet(UINT32 addr)
+    {
+        return (addr >> m_blksz_log) & ((1 << m_set_log) - 1);
+    }
+
+    // Look up the cache to decide whether the access is hit or missed
+    bool lookup(UINT32 mem_addr, UINT32& blk_id)
+    {
+        UINT32 setNum = getSet(mem_addr);
+
+        for (UINT32 i = 0; i < m_set_block_num; i++) {
+            if (m_tags[setNum * m_set_block_num + i] == getTag(mem_addr)) {
+                blk_id = setNum * m_set_block_num + i;
+
+                return m_valids[blk_id];
+            }
+        }
+
+        return false;
+    }
+
+    // Access the cache: update m_replace_q if hit, otherwise replace a block and update m_replace_q
+    bool access(UINT32 mem_addr)
+    {
+        UINT32 blk_id;
+        if (lookup(mem_addr, blk_id)) {
+            updateReplaceQ(blk_id);
+            return true;
+        }
+
+        UINT32 set_id = getSet(mem_addr);
+        UINT32 bid_2be_replaced = m_replace_q[set_id * m_set_block_num];
+        m_tags[bid_2be_replaced] = getTag(mem_addr);
+        m_valids[bid_2be_replaced] = true;
+        updateReplaceQ(bid_2be_replaced);
+
+        return false;
+    }
+
+    // Update m_replace_q
+    void updateReplaceQ(UINT32 blk_id)
+    {
+        UINT32 set_id = blk_id / m_set_block_num;
+
+        for (UINT32 i = 0; i < m_set_block_num; i++) {
+            if (m_replace_q[set_id * m_set_block_num + i] == blk_id) {
+                for (UINT32 j = i + 1; j < m_set_block_num; j++) {
+                    m_replace_q[set_id * m_set_block_num + j - 1] = m_replace_q[set_id * m_set_block_num + j];
+                }
+                m_replace_q[(set_id + 1) * m_set_block_num - 1] = blk_id;
+
+                break;
+            }
+        }
+    }
+};
+
+/**************************************
+ * Set-Associative Cache Class (VIVT)
+ **************************************/
+class SetAssoCache_VIVT : public CacheModel {
+public:
+    // Constructor
+    SetAssoCache_VIVT(UINT32 set_log, UINT32 block_size_log, UINT32 set_block_num)
+        : CacheModel(pow(2.0, set_log) * set_block_num, block_size_log)
+    {
+        this->m_set_block_num = set_block_num;
+        this->m_set_log = set_log;
+    }
+
+    // Destructor
+    ~SetAssoCache_VIVT() { }
+
+private:
+    UINT32 m_set_block_num;
+    UINT32 m_set_log;
+
+    UINT32 getTag(UINT32 addr)
+    {
+        return addr >> (m_set_log + m_blksz_log);
+    }
+
+    UINT32 getSet(UINT32 addr)
+    {
+        return (addr >> m_blksz_log) & ((1 << m_set_log) - 1);
+    }
+
+    // Look up the cache to decide whether the access is hit or missed
+    bool lookup(UINT32 mem_addr, UINT32& blk_id)
+    {
+        UINT32 setNum = getSet(mem_addr);
+
+        for (UINT32 i = 0; i < m_set_block_num; i++) {
+            if (m_tags[setNum * m_set_block_num + i] == getTag(mem_addr)) {
+                blk_id = setNum * m_set_block_num + i;
+
+                return m_valids[blk_id];
+            }
+        }
+
+        return false;
+    }
+
+    // Access the cache: update m_replace_q if hit, otherwise replace a block and update m_replace_q
+    bool access(UINT32 mem_addr)
+    {
+        UINT32 blk_id;
+        if (lookup(mem_addr, blk_id)) {
+            updateReplaceQ(blk_id);
+            return true;
+        }
+
+        UINT32 set_id = getSet(mem_addr);
+        UINT32 bid_2be_replaced = m_replace_q[set_id * m_set_block_num];
+        m_tags[bid_2be_replaced] = getTag(mem_addr);
+        m_valids[bid_2be_replaced] = true;
+        updateReplaceQ(bid_2be_replaced);
+
+        return false;
+    }
+
+    // Update m_replace_q
+    void updateReplaceQ(UINT32 blk_id)
+    {
+        UINT32 set_id = blk_id / m_set_block_num;
+
+        for (UINT32 i = 0; i < m_set_block_num; i++) {
+            if (m_replace_q[set_id * m_set_block_num + i] == blk_id) {
+                for (UINT32 j = i + 1; j < m_set_block_num; j++) {
+                    m_replace_q[set_id * m_set_block_num + j - 1] = m_replace_q[set_id * m_set_block_num + j];
+                }
+                m_replace_q[(set_id + 1) * m_set_block_num - 1] = blk_id;
+
+                break;
+            }
+        }
+    }
+};
+
+/**************************************
+ * Set-Associative Cache Class (PIPT)
+ **************************************/
+class SetAssoCache_PIPT : public CacheModel {
+public:
+    // Constructor
+    SetAssoCache_PIPT(UINT32 set_log, UINT32 block_size_log, UINT32 set_block_num)
+        : CacheModel(pow(2.0, set_log) * set_block_num, block_size_log)
+    {
+        this->m_set_block_num = set_block_num;
+        this->m_set_log = set_log;
+    }
+
+    // Destructor
+    ~SetAssoCache_PIPT() { }
+
+private:
+    UINT32 m_set_block_num;
+    UINT32 m_set_log;
+
+    UINT32 getTag(UINT32 addr)
+    {
+        return addr >> (m_set_log + m_blksz_log);
+    }
+
+    UINT32 getSet(UINT32 addr)
+    {
+        return (addr >> m_blksz_log) & ((1 << m_set_log) - 1);
+    }
+
+    // Look up the cache to decide whether the access is hit or missed
+    bool lookup(UINT32 p_addr, UINT32& blk_id)
+    {
+        UINT32 setNum = getSet(p_addr);
+
+        for (UINT32 i = 0; i < m_set_block_num; i++) {
+            if (m_tags[setNum * m_set_block_num + i] == getTag(p_addr)) {
+                blk_id = setNum * m_set_block_num + i;
+
+                return m_valids[blk_id];
+            }
+        }
+
+        return false;
+    }
+
+    // Access the cache: update m_replace_q if hit, otherwise replace a block and update m_replace_q
+    bool access(UINT32 mem_addr)
+    {
+        UINT32 p_addr = get_phy_addr(mem_addr);
+
+        UINT32 blk_id;
+        if (lookup(p_addr, blk_id)) {
+            updateReplaceQ(blk_id);
+            return true;
+        }
+
+        UINT32 set_id = getSet(p_addr);
+        UINT32 bid_2be_replaced = m_replace_q[set_id * m_set_block_num];
+        m_tags[bid_2be_replaced] = getTag(p_addr);
+        m_valids[bid_2be_replaced] = true;
+        updateReplaceQ(bid_2be_replaced);
+
+        return false;
+    }
+
+    // Update m_replace_q
+    void updateReplaceQ(UINT32 blk_id)
+    {
+        UINT32 set_id = blk_id / m_set_block_num;
+
+        for (UINT32 i = 0; i < m_set_block_num; i++) {
+            if (m_replace_q[set_id * m_set_block_num + i] == blk_id) {
+                for (UINT32 j = i + 1; j < m_set_block_num; j++) {
+                    m_replace_q[set_id * m_set_block_num + j - 1] = m_replace_q[set_id * m_set_block_num + j];
+                }
+                m_replace_q[(set_id + 1) * m_set_block_num - 1] = blk_id;
+
+                break;
+            }
+        }
+    }
+};
+
+/**************************************
+ * Set-Associative Cache Class (VIPT)
+ **************************************/
+class SetAssoCache_VIPT : public CacheModel {
+public:
+    // Constructor
+    SetAssoCache_VIPT(UINT32 set_log, UINT32 block_size_log, UINT32 set_block_num)
+        : CacheModel(pow(2.0, set_log) * set_block_num, block_size_log)
+    {
+        this->m_set_block_num = set_block_num;
+        this->m_set_log = set_log;
+    }
+
+    // Destructor
+    ~SetAssoCache_VIPT() { }
+
+private:
+    UINT32 m_set_block_num;
+    UINT32 m_set_log;
+
+    UINT32 getTag(UINT32 addr)
+    {
+        return addr >> (m_set_log + m_blksz_log);
+    }
+
+    UINT32 getSet(UINT32 addr)
+    {
+        return (addr >> m_blksz_log) & ((1 << m_set_log) - 1);
+    }
+
+    // Look up the cache to decide whether the access is hit or missed
+    bool lookup(UINT32 mem_addr, UINT32& blk_id)
+    {
+        UINT32 p_addr = get_phy_addr(mem_addr);
+
+        UINT32 setNum = getSet(mem_addr);
+
+        for (UINT32 i = 0; i < m_set_block_num; i++) {
+            if (m_tags[setNum * m_set_block_num + i] == getTag(p_addr)) {
+                blk_id = setNum * m_set_block_num + i;
+
+                return m_valids[blk_id];
+            }
+        }
+
+        return false;
+    }
+
+    // Access the cache: update m_replace_q if hit, otherwise replace a block and update m_replace_q
+    bool access(UINT32 mem_addr)
+    {
+        UINT32 p_addr = get_phy_addr(mem_addr);
+
+        UINT32 blk_id;
+        if (lookup(mem_addr, blk_id)) {
+            updateReplaceQ(blk_id);
+            return true;
+        }
+
+        UINT32 set_id = getSet(mem_addr);
+        UINT32 bid_2be_replaced = m_replace_q[set_id * m_set_block_num];
+        m_tags[bid_2be_replaced] = getTag(p_addr);
+        m_valids[bid_2be_replaced] = true;
+        updateReplaceQ(bid_2be_replaced);
+
+        return false;
+    }
+
+    // Update m_replace_q
+    void updateReplaceQ(UINT32 blk_id)
+    {
+        UINT32 set_id = blk_id / m_set_block_num;
+
+        for (UINT32 i = 0; i < m_set_block_num; i++) {
+            if (m_replace_q[set_id * m_set_block_num + i] == blk_id) {
+                for (UINT32 j = i + 1; j < m_set_block_num; j++) {
+                    m_replace_q[set_id * m_set_block_num + j - 1] = m_replace_q[set_id * m_set_block_num + j];
+                }
+                m_replace_q[(set_id + 1) * m_set_block_num - 1] = blk_id;
+
+                break;
+            }
+        }
+    }
+};
+
+/**************************************
+ * The caches of the lab, fed with the same accesses
+ **************************************/
+class CacheModels {
+public:
+    CacheModels(UINT32 block_num, UINT32 sets_log, UINT32 log_block_size, UINT32 asso)
+    {
+        m_fa_cache = new FullAssoCache(block_num, log_block_size);
+        m_sa_cache = new SetAssoCache(sets_log, log_block_size, asso);
+
+        m_sa_cache_vivt = new SetAssoCache_VIVT(sets_log, log_block_size, asso);
+        m_sa_cache_pipt = new SetAssoCache_PIPT(sets_log, log_block_size, asso);
+        m_sa_cache_vipt = new SetAssoCache_VIPT(sets_log, log_block_size, asso);
+    }
+
+    ~CacheModels()
+    {
+        delete m_fa_cache;
+        delete m_sa_cache;
+
+        delete m_sa_cache_vivt;
+        delete m_sa_cache_pipt;
+        delete m_sa_cache_vipt;
+    }
+
+    // Accesses are word aligned
+    void readReq(UINT32 mem_addr)
+    {
+        mem_addr = (mem_addr >> 2) << 2;
+
+        m_fa_cache->readReq(mem_addr);
+        m_sa_cache->readReq(mem_addr);
+
+        m_sa_cache_vivt->readReq(mem_addr);
+        m_sa_cache_pipt->readReq(mem_addr);
+        m_sa_cache_vipt->readReq(mem_addr);
+    }
+
+    void writeReq(UINT32 mem_addr)
+    {
+        mem_addr = (mem_addr >> 2) << 2;
+
+        m_fa_cache->writeReq(mem_addr);
+        m_sa_cache->writeReq(mem_addr);
+
+        m_sa_cache_vivt->writeReq(mem_addr);
+        m_sa_cache_pipt->writeReq(mem_addr);
+        m_sa_cache_vipt->writeReq(mem_addr);
+    }
+
+    // Add the stats of caches built with the same parameters
+    void merge(const CacheModels& other)
+    {
+        m_fa_cache->merge(*other.m_fa_cache);
+        m_sa_cache->merge(*other.m_sa_cache);
+
+        m_sa_cache_vivt->merge(*other.m_sa_cache_vivt);
+        m_sa_cache_pipt->merge(*other.m_sa_cache_pipt);
+        m_sa_cache_vipt->merge(*other.m_sa_cache_vipt);
+    }
+
+    void dumpResults()
+    {
+        printf("\nFully Associative Cache:\n");
+        m_fa_cache->dumpResults();
+
+        printf("\nSet-Associative Cache:\n");
+        m_sa_cache->dumpResults();
+
+        printf("\nSet-Associative Cache (VIVT):\n");
+        m_sa_cache_vivt->dumpResults();
+
+        printf("\nSet-Associative Cache (PIPT):\n");
+        m_sa_cache_pipt->dumpResults();
+
+        printf("\nSet-Associative Cache (VIPT):\n");
+        m_sa_cache_vipt->dumpResults();
+    }
+
+private:
+    CacheModel* m_fa_cache;
+    CacheModel* m_sa_cache;
+    CacheModel* m_sa_cache_vivt;
+    CacheModel* m_sa_cache_pipt;
+    CacheModel* m_sa_cache_vipt;
+};
+
+#endif // CACHE_MODEL_H